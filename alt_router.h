@@ -0,0 +1,374 @@
+#pragma once
+
+#include "graph.h"
+#include "graph_serialization.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <limits>
+#include <optional>
+#include <ostream>
+#include <queue>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Graph {
+
+  // Point-to-point bidirectional A* without an all-pairs precompute. Vertices are explored in the
+  // order of the distance plus a lower bound of the rest: an external one (e.g. geographic)
+  // and the ALT one, by the triangle inequality over distances to and from landmarks
+  // chosen at build time. Has the same route API as Router.
+  template <typename Weight>
+  class AltRouter {
+  private:
+    using Graph = DirectedWeightedGraph<Weight>;
+
+  public:
+    // Never above the distance between the vertices; must satisfy the triangle inequality
+    using LowerBound = std::function<Weight(VertexId from, VertexId to)>;
+
+    AltRouter(const Graph& graph, size_t landmark_count, LowerBound lower_bound = nullptr);
+
+    using RouteId = uint64_t;
+
+    struct RouteInfo {
+      RouteId id;
+      Weight weight;
+      size_t edge_count;
+    };
+
+    std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
+    EdgeId GetRouteEdge(RouteId route_id, size_t edge_idx) const;
+    void ReleaseRoute(RouteId route_id);
+
+    size_t GetLandmarkCount() const { return landmarks_.size(); }
+    MemoryUsage GetMemoryUsage() const;  // of the landmark distances
+
+    void Serialize(std::ostream& output) const;
+    // The graph must be the one the landmarks were chosen for
+    static AltRouter Deserialize(const Graph& graph, std::istream& input, LowerBound lower_bound = nullptr);
+
+  private:
+    AltRouter(const Graph& graph, LowerBound lower_bound);
+
+    static constexpr Weight UNREACHABLE = std::numeric_limits<Weight>::max();
+
+    struct SearchLabel {
+      Weight distance;
+      std::optional<EdgeId> parent_edge;
+    };
+    struct SearchSpace {
+      std::vector<std::optional<SearchLabel>> labels;
+      std::vector<VertexId> touched_vertices;
+
+      void Reset();
+      bool Label(VertexId vertex, SearchLabel label);
+    };
+
+    void BuildIncomingEdges();
+    // Distances from (is_forward) or to the source over the whole graph, UNREACHABLE if none
+    std::vector<Weight> ComputeDistances(VertexId source, bool is_forward) const;
+    void ChooseLandmarks(size_t landmark_count);
+
+    Weight ComputeLowerBound(VertexId from, VertexId to) const;
+    // Potential of the forward search; the backward one uses its negation
+    Weight ComputePotential(VertexId vertex, VertexId from, VertexId to) const;
+
+    const Graph& graph_;
+    LowerBound lower_bound_;
+    std::vector<size_t> incoming_offsets_;
+    std::vector<EdgeId> incoming_edges_;
+
+    std::vector<VertexId> landmarks_;
+    // landmark_idx * vertex count + vertex
+    std::vector<Weight> distances_from_landmarks_;
+    std::vector<Weight> distances_to_landmarks_;
+
+    mutable SearchSpace forward_search_;
+    mutable SearchSpace backward_search_;
+
+    using ExpandedRoute = std::vector<EdgeId>;
+    mutable RouteId next_route_id_ = 0;
+    mutable std::unordered_map<RouteId, ExpandedRoute> expanded_routes_cache_;
+  };
+
+
+  template <typename Weight>
+  void AltRouter<Weight>::SearchSpace::Reset() {
+    for (const VertexId vertex : touched_vertices) {
+      labels[vertex].reset();
+    }
+    touched_vertices.clear();
+  }
+
+  template <typename Weight>
+  bool AltRouter<Weight>::SearchSpace::Label(VertexId vertex, SearchLabel label) {
+    auto& current_label = labels[vertex];
+    if (!current_label) {
+      touched_vertices.push_back(vertex);
+    } else if (current_label->distance <= label.distance) {
+      return false;
+    }
+    current_label = label;
+    return true;
+  }
+
+  template <typename Weight>
+  AltRouter<Weight>::AltRouter(const Graph& graph, LowerBound lower_bound)
+      : graph_(graph),
+        lower_bound_(std::move(lower_bound))
+  {
+    BuildIncomingEdges();
+    forward_search_.labels.resize(graph.GetVertexCount());
+    backward_search_.labels.resize(graph.GetVertexCount());
+  }
+
+  template <typename Weight>
+  AltRouter<Weight>::AltRouter(const Graph& graph, size_t landmark_count, LowerBound lower_bound)
+      : AltRouter(graph, std::move(lower_bound))
+  {
+    ChooseLandmarks(std::min(landmark_count, graph.GetVertexCount()));
+  }
+
+  template <typename Weight>
+  void AltRouter<Weight>::BuildIncomingEdges() {
+    const size_t vertex_count = graph_.GetVertexCount();
+    incoming_offsets_.assign(vertex_count + 1, 0);
+    for (EdgeId edge_id = 0; edge_id < graph_.GetEdgeCount(); ++edge_id) {
+      ++incoming_offsets_[graph_.GetEdge(edge_id).to + 1];
+    }
+    for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+      incoming_offsets_[vertex + 1] += incoming_offsets_[vertex];
+    }
+    incoming_edges_.resize(graph_.GetEdgeCount());
+    std::vector<size_t> positions(std::begin(incoming_offsets_), std::prev(std::end(incoming_offsets_)));
+    for (EdgeId edge_id = 0; edge_id < graph_.GetEdgeCount(); ++edge_id) {
+      incoming_edges_[positions[graph_.GetEdge(edge_id).to]++] = edge_id;
+    }
+  }
+
+  template <typename Weight>
+  std::vector<Weight> AltRouter<Weight>::ComputeDistances(VertexId source, bool is_forward) const {
+    std::vector<Weight> distances(graph_.GetVertexCount(), UNREACHABLE);
+    using QueueItem = std::pair<Weight, VertexId>;
+    std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+    distances[source] = 0;
+    queue.push({0, source});
+    while (!queue.empty()) {
+      const auto [distance, vertex] = queue.top();
+      queue.pop();
+      if (distance > distances[vertex]) {
+        continue;
+      }
+      const auto relax = [&](EdgeId edge_id) {
+        const auto& edge = graph_.GetEdge(edge_id);
+        const VertexId next_vertex = is_forward ? edge.to : edge.from;
+        const Weight candidate = distance + edge.weight;
+        if (candidate < distances[next_vertex]) {
+          distances[next_vertex] = candidate;
+          queue.push({candidate, next_vertex});
+        }
+      };
+      if (is_forward) {
+        for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+          relax(edge_id);
+        }
+      } else {
+        for (size_t idx = incoming_offsets_[vertex]; idx < incoming_offsets_[vertex + 1]; ++idx) {
+          relax(incoming_edges_[idx]);
+        }
+      }
+    }
+    return distances;
+  }
+
+  template <typename Weight>
+  void AltRouter<Weight>::ChooseLandmarks(size_t landmark_count) {
+    // farthest-first: each landmark is the vertex farthest from the landmarks chosen before,
+    // the first one the vertex farthest from vertex 0
+    const size_t vertex_count = graph_.GetVertexCount();
+    std::vector<Weight> separations(vertex_count, UNREACHABLE);
+    const auto add_separations = [&](const std::vector<Weight>& from_distances, const std::vector<Weight>& to_distances) {
+      for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+        // unreachable pairs are not separated: a landmark gives no bound for them
+        const Weight separation = (from_distances[vertex] != UNREACHABLE ? from_distances[vertex] : 0)
+            + (to_distances[vertex] != UNREACHABLE ? to_distances[vertex] : 0);
+        separations[vertex] = std::min(separations[vertex], separation);
+      }
+    };
+    if (landmark_count > 0) {
+      add_separations(ComputeDistances(0, true), ComputeDistances(0, false));
+    }
+
+    for (size_t landmark_idx = 0; landmark_idx < landmark_count; ++landmark_idx) {
+      const VertexId landmark = std::max_element(std::begin(separations), std::end(separations)) - std::begin(separations);
+      landmarks_.push_back(landmark);
+      const auto from_distances = ComputeDistances(landmark, true);
+      const auto to_distances = ComputeDistances(landmark, false);
+      distances_from_landmarks_.insert(std::end(distances_from_landmarks_), std::begin(from_distances), std::end(from_distances));
+      distances_to_landmarks_.insert(std::end(distances_to_landmarks_), std::begin(to_distances), std::end(to_distances));
+      if (landmark_idx == 0) {
+        separations.assign(vertex_count, UNREACHABLE);
+      }
+      add_separations(from_distances, to_distances);
+      separations[landmark] = 0;
+    }
+  }
+
+  template <typename Weight>
+  Weight AltRouter<Weight>::ComputeLowerBound(VertexId from, VertexId to) const {
+    Weight bound = lower_bound_ ? std::max<Weight>(0, lower_bound_(from, to)) : 0;
+    const size_t vertex_count = graph_.GetVertexCount();
+    for (size_t offset = 0; offset < distances_from_landmarks_.size(); offset += vertex_count) {
+      // d(L, to) <= d(L, from) + d(from, to) and d(from, L) <= d(from, to) + d(to, L)
+      const Weight landmark_to = distances_from_landmarks_[offset + to];
+      const Weight landmark_from = distances_from_landmarks_[offset + from];
+      if (landmark_to != UNREACHABLE && landmark_from != UNREACHABLE) {
+        bound = std::max(bound, landmark_to - landmark_from);
+      }
+      const Weight from_landmark = distances_to_landmarks_[offset + from];
+      const Weight to_landmark = distances_to_landmarks_[offset + to];
+      if (from_landmark != UNREACHABLE && to_landmark != UNREACHABLE) {
+        bound = std::max(bound, from_landmark - to_landmark);
+      }
+    }
+    return bound;
+  }
+
+  template <typename Weight>
+  Weight AltRouter<Weight>::ComputePotential(VertexId vertex, VertexId from, VertexId to) const {
+    // the average of the bounds towards both ends keeps the two searches consistent with each other
+    return (ComputeLowerBound(vertex, to) - ComputeLowerBound(from, vertex)) / 2;
+  }
+
+  template <typename Weight>
+  std::optional<typename AltRouter<Weight>::RouteInfo> AltRouter<Weight>::BuildRoute(VertexId from, VertexId to) const {
+    forward_search_.Reset();
+    backward_search_.Reset();
+
+    using QueueItem = std::pair<Weight, VertexId>;  // distance + potential
+    using Queue = std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>>;
+    Queue forward_queue;
+    Queue backward_queue;
+    forward_search_.Label(from, {0, std::nullopt});
+    forward_queue.push({ComputePotential(from, from, to), from});
+    backward_search_.Label(to, {0, std::nullopt});
+    backward_queue.push({-ComputePotential(to, from, to), to});
+
+    Weight best_distance = UNREACHABLE;
+    std::optional<VertexId> meeting_vertex;
+    if (from == to) {
+      best_distance = 0;
+      meeting_vertex = from;
+    }
+
+    // with potentials p and -p the keys of a route through v sum up to its length,
+    // so no better route remains once the smallest keys do
+    while (!forward_queue.empty() && !backward_queue.empty()
+           && (best_distance == UNREACHABLE || forward_queue.top().first + backward_queue.top().first < best_distance)) {
+      const bool is_forward = forward_queue.top().first <= backward_queue.top().first;
+      Queue& queue = is_forward ? forward_queue : backward_queue;
+      SearchSpace& search = is_forward ? forward_search_ : backward_search_;
+      const SearchSpace& other_search = is_forward ? backward_search_ : forward_search_;
+
+      const auto [key, vertex] = queue.top();
+      queue.pop();
+      const Weight distance = search.labels[vertex]->distance;
+      const Weight potential = is_forward ? ComputePotential(vertex, from, to) : -ComputePotential(vertex, from, to);
+      if (key > distance + potential) {
+        continue;  // outdated
+      }
+
+      const auto relax = [&](EdgeId edge_id) {
+        const auto& edge = graph_.GetEdge(edge_id);
+        const VertexId next_vertex = is_forward ? edge.to : edge.from;
+        const Weight candidate = distance + edge.weight;
+        if (!search.Label(next_vertex, {candidate, edge_id})) {
+          return;
+        }
+        const Weight next_potential = ComputePotential(next_vertex, from, to);
+        queue.push({candidate + (is_forward ? next_potential : -next_potential), next_vertex});
+        if (const auto& other_label = other_search.labels[next_vertex];
+            other_label && candidate + other_label->distance < best_distance) {
+          best_distance = candidate + other_label->distance;
+          meeting_vertex = next_vertex;
+        }
+      };
+      if (is_forward) {
+        for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+          relax(edge_id);
+        }
+      } else {
+        for (size_t idx = incoming_offsets_[vertex]; idx < incoming_offsets_[vertex + 1]; ++idx) {
+          relax(incoming_edges_[idx]);
+        }
+      }
+    }
+
+    if (!meeting_vertex) {
+      return std::nullopt;
+    }
+
+    std::vector<EdgeId> edges;
+    for (VertexId vertex = *meeting_vertex; const auto parent_edge = forward_search_.labels[vertex]->parent_edge; ) {
+      edges.push_back(*parent_edge);
+      vertex = graph_.GetEdge(*parent_edge).from;
+    }
+    std::reverse(std::begin(edges), std::end(edges));
+    for (VertexId vertex = *meeting_vertex; const auto parent_edge = backward_search_.labels[vertex]->parent_edge; ) {
+      edges.push_back(*parent_edge);
+      vertex = graph_.GetEdge(*parent_edge).to;
+    }
+
+    const RouteId route_id = next_route_id_++;
+    const size_t route_edge_count = edges.size();
+    expanded_routes_cache_[route_id] = std::move(edges);
+    return RouteInfo{route_id, best_distance, route_edge_count};
+  }
+
+  template <typename Weight>
+  EdgeId AltRouter<Weight>::GetRouteEdge(RouteId route_id, size_t edge_idx) const {
+    return expanded_routes_cache_.at(route_id)[edge_idx];
+  }
+
+  template <typename Weight>
+  void AltRouter<Weight>::ReleaseRoute(RouteId route_id) {
+    expanded_routes_cache_.erase(route_id);
+  }
+
+  template <typename Weight>
+  MemoryUsage AltRouter<Weight>::GetMemoryUsage() const {
+    return ComputeMemoryUsage(landmarks_)
+        + ComputeMemoryUsage(distances_from_landmarks_) + ComputeMemoryUsage(distances_to_landmarks_)
+        + ComputeMemoryUsage(incoming_offsets_)
+        + ComputeMemoryUsage(incoming_edges_);
+  }
+
+  // Binary, for the same build only: no versioning or endianness conversion
+  template <typename Weight>
+  void AltRouter<Weight>::Serialize(std::ostream& output) const {
+    Detail::WriteVector(output, landmarks_);
+    Detail::WriteVector(output, distances_from_landmarks_);
+    Detail::WriteVector(output, distances_to_landmarks_);
+  }
+
+  template <typename Weight>
+  AltRouter<Weight> AltRouter<Weight>::Deserialize(const Graph& graph, std::istream& input, LowerBound lower_bound) {
+    AltRouter result(graph, std::move(lower_bound));
+    result.landmarks_ = Detail::ReadVector<VertexId>(input);
+    result.distances_from_landmarks_ = Detail::ReadVector<Weight>(input);
+    result.distances_to_landmarks_ = Detail::ReadVector<Weight>(input);
+    const size_t distance_count = result.landmarks_.size() * graph.GetVertexCount();
+    if (result.distances_from_landmarks_.size() != distance_count
+        || result.distances_to_landmarks_.size() != distance_count
+        || std::any_of(std::begin(result.landmarks_), std::end(result.landmarks_), [&graph](VertexId vertex) { return vertex >= graph.GetVertexCount(); })) {
+      throw std::runtime_error("Malformed landmarks");
+    }
+    return result;
+  }
+
+}
@@ -0,0 +1,401 @@
+#include "bench.h"
+#include "descriptions.h"
+#include "graph.h"
+#include "json.h"
+#include "router.h"
+#include "sphere.h"
+#include "svg.h"
+#include "transport_router.h"
+
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+using namespace std;
+
+namespace Bench {
+
+  // Keeps the results of operations from being optimized away
+  static volatile double sink;
+
+  void Runner::Run(const string& name, const Operation& operation) {
+    operation();  // warm-up: caches, lazily grown buffers
+
+    const size_t start_allocated_bytes = GetAllocatedBytes();
+    const auto start_time = chrono::steady_clock::now();
+    size_t op_count = 0;
+    size_t item_count = 0;
+    double seconds = 0;
+    for (size_t batch_size = 1; seconds < min_seconds_; batch_size *= 2) {
+      for (size_t op_idx = 0; op_idx < batch_size; ++op_idx) {
+        item_count += operation();
+      }
+      op_count += batch_size;
+      seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+    }
+
+    results_.push_back({
+        .name = name,
+        .ns_per_op = seconds * 1e9 / op_count,
+        .bytes_per_op = static_cast<double>(GetAllocatedBytes() - start_allocated_bytes) / op_count,
+        .items_per_second = item_count / seconds,
+    });
+  }
+
+  static size_t CountNodes(const Json::Node& node) {
+    size_t count = 1;
+    if (holds_alternative<vector<Json::Node>>(node)) {
+      for (const auto& item : node.AsArray()) {
+        count += CountNodes(item);
+      }
+    } else if (holds_alternative<Json::Dict>(node)) {
+      for (const auto& [_, value] : node.AsMap()) {
+        count += CountNodes(value);
+      }
+    }
+    return count;
+  }
+
+  // An array of stop-like dicts
+  static string MakeWideJson(size_t item_count) {
+    ostringstream output;
+    output << "[";
+    for (size_t item_idx = 0; item_idx < item_count; ++item_idx) {
+      output << (item_idx > 0 ? ", " : "")
+             << "{\"type\": \"Stop\", \"name\": \"Stop " << item_idx << "\", "
+             << "\"latitude\": 55." << item_idx << ", \"longitude\": 37." << item_idx << ", "
+             << "\"road_distances\": {\"Stop " << item_idx + 1 << "\": " << 1000 + item_idx % 1000 << "}}";
+    }
+    output << "]";
+    return output.str();
+  }
+
+  // Dicts nested depth times
+  static string MakeDeepJson(size_t depth) {
+    string prefix;
+    for (size_t level = 0; level < depth; ++level) {
+      prefix += "{\"level\": " + to_string(level) + ", \"name\": \"level " + to_string(level) + "\", \"next\": ";
+    }
+    return prefix + "null" + string(depth, '}');
+  }
+
+  static void AddJsonCases(Runner& runner) {
+    for (const auto& [name, text] : {pair{"wide", MakeWideJson(10000)}, pair{"deep", MakeDeepJson(1000)}}) {
+      auto input = make_shared<istringstream>(text);
+      runner.Run("json/load/" + string(name), [input] {
+        input->clear();
+        input->seekg(0);
+        const Json::Document document = Json::Load(*input);
+        return CountNodes(document.GetRoot());
+      });
+
+      input->clear();
+      input->seekg(0);
+      auto document = make_shared<Json::Document>(Json::Load(*input));
+      const size_t node_count = CountNodes(document->GetRoot());
+      auto output = make_shared<ostringstream>();
+      runner.Run("json/print/" + string(name), [document, output, node_count] {
+        output->seekp(0);
+        const Json::Node& root = document->GetRoot();
+        if (holds_alternative<Json::Dict>(root)) {
+          Json::PrintValue(root.AsMap(), *output);
+        } else {
+          Json::PrintValue(root.AsArray(), *output);
+        }
+        return node_count;
+      });
+    }
+  }
+
+  static void AddSvgCases(Runner& runner) {
+    const size_t object_count = 2000;
+    const size_t point_count = 16;
+    mt19937 random_engine(42);
+    uniform_real_distribution<double> coordinate(0, 1000);
+
+    auto document = make_shared<Svg::Document>();
+    for (size_t object_idx = 0; object_idx < object_count; ++object_idx) {
+      Svg::Polyline polyline;
+      polyline.SetStrokeColor("green").SetStrokeWidth(14).SetStrokeLineCap("round").SetStrokeLineJoin("round");
+      for (size_t point_idx = 0; point_idx < point_count; ++point_idx) {
+        polyline.AddPoint({coordinate(random_engine), coordinate(random_engine)});
+      }
+      document->Add(move(polyline));
+      document->Add(Svg::Text{}
+                        .SetPoint({coordinate(random_engine), coordinate(random_engine)})
+                        .SetOffset({7, 15})
+                        .SetFontSize(20)
+                        .SetFontFamily("Verdana")
+                        .SetFillColor(Svg::Rgb{255, 160, 0})
+                        .SetData("Stop " + to_string(object_idx)));
+    }
+    auto output = make_shared<ostringstream>();
+    runner.Run("svg/render", [document, output, object_count] {
+      output->seekp(0);
+      document->Render(*output);
+      return 2 * object_count;
+    });
+  }
+
+  static void AddSphereCases(Runner& runner) {
+    mt19937 random_engine(42);
+    uniform_real_distribution<double> latitude(55.5, 56), longitude(37.3, 37.9);
+    auto points = make_shared<vector<Sphere::Point>>(4096);
+    for (auto& point : *points) {
+      point = {latitude(random_engine), longitude(random_engine)};
+    }
+    runner.Run("sphere/distance", [points] {
+      double total = 0;
+      for (size_t point_idx = 1; point_idx < points->size(); ++point_idx) {
+        total += Sphere::Distance((*points)[point_idx - 1], (*points)[point_idx]);
+      }
+      sink = total;
+      return points->size() - 1;
+    });
+  }
+
+  using BenchGraph = Graph::DirectedWeightedGraph<double>;
+
+  static vector<Graph::Edge<double>> MakeRandomEdges(size_t vertex_count, size_t edges_per_vertex) {
+    mt19937 random_engine(42);
+    uniform_int_distribution<Graph::VertexId> vertex(0, vertex_count - 1);
+    uniform_real_distribution<double> weight(1, 30);
+    vector<Graph::Edge<double>> edges(vertex_count * edges_per_vertex);
+    for (auto& edge : edges) {
+      edge = {vertex(random_engine), vertex(random_engine), weight(random_engine)};
+    }
+    return edges;
+  }
+
+  static void AddGraphCases(Runner& runner) {
+    for (const size_t vertex_count : {1024, 16384}) {
+      auto edges = make_shared<vector<Graph::Edge<double>>>(MakeRandomEdges(vertex_count, 4));
+      runner.Run("graph/add_edge/" + to_string(vertex_count), [edges, vertex_count] {
+        BenchGraph graph(vertex_count);
+        for (const auto& edge : *edges) {
+          graph.AddEdge(edge);
+        }
+        return edges->size();
+      });
+    }
+
+    for (const size_t vertex_count : {64, 256, 512}) {
+      auto graph = make_shared<BenchGraph>(vertex_count);
+      for (const auto& edge : MakeRandomEdges(vertex_count, 4)) {
+        graph->AddEdge(edge);
+      }
+      graph->Freeze();
+      runner.Run("graph/router_build/" + to_string(vertex_count), [graph, vertex_count] {
+        const Graph::Router<double> router(*graph);
+        return vertex_count * vertex_count;
+      });
+
+      auto router = make_shared<Graph::Router<double>>(*graph);
+      mt19937 random_engine(42);
+      uniform_int_distribution<Graph::VertexId> vertex(0, vertex_count - 1);
+      auto queries = make_shared<vector<pair<Graph::VertexId, Graph::VertexId>>>(256);
+      for (auto& query : *queries) {
+        query = {vertex(random_engine), vertex(random_engine)};
+      }
+      runner.Run("graph/build_route/" + to_string(vertex_count), [graph, router, queries] {
+        double total = 0;
+        for (const auto& [from, to] : *queries) {
+          if (const auto route = router->BuildRoute(from, to)) {
+            total += route->weight;
+            router->ReleaseRoute(route->id);
+          }
+        }
+        sink = total;
+        return queries->size();
+      });
+    }
+  }
+
+  static void AddDescriptionsCases(Runner& runner) {
+    const size_t stop_count = 1024;
+    const size_t neighbour_count = 8;
+    auto stops = make_shared<vector<Descriptions::Stop>>(stop_count);
+    for (size_t stop_idx = 0; stop_idx < stop_count; ++stop_idx) {
+      (*stops)[stop_idx].name = "Stop " + to_string(stop_idx);
+    }
+    mt19937 random_engine(42);
+    uniform_int_distribution<size_t> stop(0, stop_count - 1);
+    // both directions: the distance is given by one of the two stops
+    auto pairs = make_shared<vector<pair<size_t, size_t>>>();
+    for (size_t stop_idx = 0; stop_idx < stop_count; ++stop_idx) {
+      for (size_t neighbour_idx = 0; neighbour_idx < neighbour_count; ++neighbour_idx) {
+        const size_t other_stop_idx = stop(random_engine);
+        (*stops)[stop_idx].distances[(*stops)[other_stop_idx].name] = 1000;
+        pairs->push_back({stop_idx, other_stop_idx});
+        pairs->push_back({other_stop_idx, stop_idx});
+      }
+    }
+    runner.Run("descriptions/stops_distance", [stops, pairs] {
+      double total = 0;
+      for (const auto& [lhs, rhs] : *pairs) {
+        total += Descriptions::ComputeStopsDistance((*stops)[lhs], (*stops)[rhs]);
+      }
+      sink = total;
+      return pairs->size();
+    });
+  }
+
+  // Grid of stops with a bus along every row and every column
+  struct GridNetwork {
+    deque<Descriptions::Stop> stops;
+    deque<Descriptions::Bus> buses;
+    Descriptions::StopsDict stops_dict;
+    Descriptions::BusesDict buses_dict;
+  };
+
+  static shared_ptr<GridNetwork> MakeGridNetwork(size_t side) {
+    auto network = make_shared<GridNetwork>();
+    auto stop_name = [](size_t row, size_t column) {
+      return "Stop " + to_string(row) + "-" + to_string(column);
+    };
+    for (size_t row = 0; row < side; ++row) {
+      for (size_t column = 0; column < side; ++column) {
+        network->stops.push_back({
+            .name = stop_name(row, column),
+            .position = {55.5 + row * 0.005, 37.5 + column * 0.008},
+        });
+      }
+    }
+    for (size_t row = 0; row < side; ++row) {
+      for (size_t column = 0; column < side; ++column) {
+        auto& stop = network->stops[row * side + column];
+        auto add_distance = [&stop](const Descriptions::Stop& neighbour) {
+          stop.distances[neighbour.name] = static_cast<int>(lround(Sphere::Distance(stop.position, neighbour.position) * 1.3));
+        };
+        if (row + 1 < side) {
+          add_distance(network->stops[(row + 1) * side + column]);
+        }
+        if (column + 1 < side) {
+          add_distance(network->stops[row * side + column + 1]);
+        }
+      }
+    }
+    for (const auto& stop : network->stops) {
+      network->stops_dict[stop.name] = &stop;
+    }
+    for (size_t line = 0; line < side; ++line) {
+      Descriptions::Bus row_bus{.name = "Row " + to_string(line), .is_roundtrip = false};
+      Descriptions::Bus column_bus{.name = "Column " + to_string(line), .is_roundtrip = false};
+      for (size_t idx = 0; idx < side; ++idx) {
+        row_bus.stops.push_back(stop_name(line, idx));
+        column_bus.stops.push_back(stop_name(idx, line));
+      }
+      network->buses.push_back(move(row_bus));
+      network->buses.push_back(move(column_bus));
+    }
+    for (const auto& bus : network->buses) {
+      network->buses_dict[bus.name] = &bus;
+    }
+    return network;
+  }
+
+  // Route queries under every vertex order: the order changes only the memory locality of the engines
+  static void AddTransportRouterCases(Runner& runner) {
+    const auto network = MakeGridNetwork(16);
+    mt19937 random_engine(42);
+    uniform_int_distribution<size_t> stop(0, network->stops.size() - 1);
+    auto queries = make_shared<vector<pair<string, string>>>(256);
+    for (auto& [from, to] : *queries) {
+      from = network->stops[stop(random_engine)].name;
+      to = network->stops[stop(random_engine)].name;
+    }
+
+    for (const string engine : {"floyd_warshall", "alt"}) {
+      for (const string vertex_order : {"input", "hilbert", "rcm"}) {
+        const Json::Dict routing_settings = {
+            {"bus_wait_time", 6},
+            {"bus_velocity", 40.0},
+            {"router", engine},
+            {"vertex_order", vertex_order},
+        };
+        auto router = make_shared<TransportRouter>(network->stops_dict, network->buses_dict, routing_settings);
+        runner.Run("transport_router/find_route/" + engine + "/" + vertex_order, [network, router, queries] {
+          double total = 0;
+          for (const auto& [from, to] : *queries) {
+            if (const auto route = router->FindRoute(from, to)) {
+              total += route->total_time;
+            }
+          }
+          sink = total;
+          return queries->size();
+        });
+      }
+    }
+  }
+
+  vector<Result> RunAll(double min_seconds) {
+    Runner runner(min_seconds);
+    AddJsonCases(runner);
+    AddSvgCases(runner);
+    AddSphereCases(runner);
+    AddGraphCases(runner);
+    AddDescriptionsCases(runner);
+    AddTransportRouterCases(runner);
+    return runner.GetResults();
+  }
+
+  void PrintResults(const vector<Result>& results, ostream& output) {
+    output << "# case ns/op B/op items/s\n";
+    for (const Result& result : results) {
+      output << result.name << ' ' << fixed << setprecision(1)
+             << result.ns_per_op << ' ' << result.bytes_per_op << ' ' << result.items_per_second << '\n';
+    }
+  }
+
+  vector<Result> ReadResults(istream& input) {
+    vector<Result> results;
+    for (string line; getline(input, line); ) {
+      if (line.empty() || line[0] == '#') {
+        continue;
+      }
+      istringstream line_input(line);
+      Result result;
+      if (!(line_input >> result.name >> result.ns_per_op >> result.bytes_per_op >> result.items_per_second)) {
+        throw runtime_error("Bad benchmark result: " + line);
+      }
+      results.push_back(move(result));
+    }
+    return results;
+  }
+
+  size_t CompareResults(const vector<Result>& results, const vector<Result>& baseline,
+                        double tolerance, ostream& output) {
+    unordered_map<string, const Result*> baseline_by_name;
+    for (const Result& result : baseline) {
+      baseline_by_name[result.name] = &result;
+    }
+    auto change = [](double value, double baseline_value) {
+      return baseline_value > 0 ? value / baseline_value - 1 : (value > 0 ? INFINITY : 0);
+    };
+
+    size_t regression_count = 0;
+    output << "# case ns/op change B/op change\n";
+    for (const Result& result : results) {
+      const auto it = baseline_by_name.find(result.name);
+      if (it == baseline_by_name.end()) {
+        output << result.name << " new\n";
+        continue;
+      }
+      const double time_change = change(result.ns_per_op, it->second->ns_per_op);
+      const double memory_change = change(result.bytes_per_op, it->second->bytes_per_op);
+      const bool is_regression = time_change > tolerance || memory_change > tolerance;
+      regression_count += is_regression;
+      output << result.name << ' ' << fixed << setprecision(1)
+             << result.ns_per_op << ' ' << showpos << time_change * 100 << "% " << noshowpos
+             << result.bytes_per_op << ' ' << showpos << memory_change * 100 << '%' << noshowpos
+             << (is_regression ? " REGRESSION" : "") << '\n';
+    }
+    return regression_count;
+  }
+
+}
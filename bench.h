@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Micro-benchmarks of the hot primitives on generated fixtures of fixed size, run by main with --bench.
+// Results are printed one case per line, so that the output of one run is the baseline of the next.
+namespace Bench {
+  struct Result {
+    std::string name;
+    double ns_per_op;
+    double bytes_per_op;  // allocated by operator new, 0 unless allocations are counted
+    double items_per_second;
+  };
+
+  // One operation over fixtures prepared beforehand; returns the number of items it processed
+  using Operation = std::function<size_t()>;
+
+  class Runner {
+  public:
+    // Every case is repeated for at least min_seconds
+    explicit Runner(double min_seconds) : min_seconds_(min_seconds) {}
+
+    void Run(const std::string& name, const Operation& operation);
+
+    const std::vector<Result>& GetResults() const { return results_; }
+
+  private:
+    double min_seconds_;
+    std::vector<Result> results_;
+  };
+
+  std::vector<Result> RunAll(double min_seconds);
+
+  void PrintResults(const std::vector<Result>& results, std::ostream& output);
+  std::vector<Result> ReadResults(std::istream& input);
+
+  // Prints the change of every case against the baseline;
+  // returns the number of cases that got slower or allocate more by more than tolerance, a fraction
+  size_t CompareResults(const std::vector<Result>& results, const std::vector<Result>& baseline,
+                        double tolerance, std::ostream& output);
+
+  // Bytes allocated by operator new on the calling thread since it started. Counted only in builds
+  // with -DTRANSPORT_BENCH_ALLOCATIONS, which replaces the global operator new; 0 otherwise
+  size_t GetAllocatedBytes();
+}
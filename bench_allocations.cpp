@@ -0,0 +1,73 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+// The counting operator new replaces the one of the whole program, so it is compiled in only
+// with -DTRANSPORT_BENCH_ALLOCATIONS. It lives in a translation unit of its own: inlined into
+// the callers, its malloc and free would be mismatched with new and delete there
+#ifdef TRANSPORT_BENCH_ALLOCATIONS
+
+namespace {
+  thread_local size_t allocated_bytes = 0;
+}
+
+// The array and nothrow forms of new and delete end up in these; the aligned ones do not
+// fall back to the plain ones in libstdc++ and are replaced as well
+void* operator new(size_t size) {
+  allocated_bytes += size;
+  if (void* ptr = malloc(size > 0 ? size : 1)) {
+    return ptr;
+  }
+  throw bad_alloc();
+}
+
+void* operator new(size_t size, align_val_t alignment) {
+  allocated_bytes += size;
+  // aligned_alloc wants a size that is a multiple of the alignment
+  const size_t align = static_cast<size_t>(alignment);
+  if (void* ptr = aligned_alloc(align, (max<size_t>(size, 1) + align - 1) / align * align)) {
+    return ptr;
+  }
+  throw bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, align_val_t) noexcept {
+  free(ptr);
+}
+
+void operator delete(void* ptr, size_t, align_val_t) noexcept {
+  free(ptr);
+}
+
+namespace Bench {
+
+  size_t GetAllocatedBytes() {
+    return allocated_bytes;
+  }
+
+}
+
+#else
+
+namespace Bench {
+
+  size_t GetAllocatedBytes() {
+    return 0;
+  }
+
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include "build_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <system_error>
+#include <vector>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace {
+  const string TEMPORARY_MARK = ".tmp.";
+  // a temporary file this old was left by a process that died while writing it
+  const auto STALE_TEMPORARY_AGE = chrono::hours(1);
+}
+
+BuildCache::BuildCache(fs::path directory, uintmax_t size_limit)
+    : directory_(move(directory)),
+      size_limit_(size_limit)
+{
+  error_code error;
+  fs::create_directories(directory_, error);
+}
+
+optional<string> BuildCache::Load(const string& key) const {
+  const fs::path path = directory_ / key;
+  ifstream input(path, ios::binary);
+  if (!input) {
+    return nullopt;
+  }
+  ostringstream data;
+  data << input.rdbuf();
+  // the modification time orders files for eviction
+  error_code error;
+  fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+  return data.str();
+}
+
+void BuildCache::Store(const string& key, const string& data) const {
+  if (data.size() > size_limit_) {
+    return;
+  }
+  random_device random;
+  const fs::path temporary_path = directory_ / (key + TEMPORARY_MARK + to_string(random()));
+  {
+    ofstream output(temporary_path, ios::binary);
+    output.write(data.data(), data.size());
+    if (!output.flush()) {
+      error_code error;
+      fs::remove(temporary_path, error);
+      return;
+    }
+  }
+  error_code error;
+  fs::rename(temporary_path, directory_ / key, error);
+  if (error) {
+    fs::remove(temporary_path, error);
+    return;
+  }
+  Evict();
+}
+
+void BuildCache::Evict() const {
+  struct File {
+    fs::path path;
+    uintmax_t size;
+    fs::file_time_type last_use;
+  };
+  vector<File> files;
+  uintmax_t total_size = 0;
+  const auto now = fs::file_time_type::clock::now();
+
+  error_code error;
+  for (const auto& entry : fs::directory_iterator(directory_, error)) {
+    error_code entry_error;
+    const uintmax_t size = entry.file_size(entry_error);
+    const auto last_use = entry.last_write_time(entry_error);
+    if (entry_error || !entry.is_regular_file(entry_error)) {
+      continue;  // removed by another process meanwhile
+    }
+    if (entry.path().filename().string().find(TEMPORARY_MARK) != string::npos) {
+      if (now - last_use > STALE_TEMPORARY_AGE) {
+        fs::remove(entry.path(), entry_error);
+      }
+      continue;
+    }
+    files.push_back({entry.path(), size, last_use});
+    total_size += size;
+  }
+
+  sort(begin(files), end(files), [](const File& lhs, const File& rhs) {
+    return lhs.last_use < rhs.last_use;
+  });
+  for (auto it = begin(files); it != end(files) && total_size > size_limit_; ++it) {
+    fs::remove(it->path, error);
+    total_size -= it->size;
+  }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+// Directory of build artifacts keyed by the hash of their input, shared by concurrent processes.
+// A file is written under a temporary name and renamed into place, so readers never see a partial
+// one; above the size limit the least recently used files are removed. Failures only mean a miss.
+class BuildCache {
+public:
+  BuildCache(std::filesystem::path directory, uintmax_t size_limit);
+
+  std::optional<std::string> Load(const std::string& key) const;
+  void Store(const std::string& key, const std::string& data) const;
+
+private:
+  void Evict() const;
+
+  std::filesystem::path directory_;
+  uintmax_t size_limit_;  // in bytes
+};
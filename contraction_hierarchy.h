@@ -0,0 +1,540 @@
+#pragma once
+
+#include "graph.h"
+#include "graph_serialization.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <queue>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Graph {
+
+  // Contraction Hierarchies: vertices are contracted one by one in the order of importance,
+  // shortcuts keep distances between the remaining vertices. A query is a bidirectional
+  // Dijkstra that only goes up the hierarchy, and found shortcuts are unpacked into graph edges.
+  // Has the same route API as Router.
+  template <typename Weight>
+  class ContractionHierarchy {
+  private:
+    using Graph = DirectedWeightedGraph<Weight>;
+
+  public:
+    explicit ContractionHierarchy(const Graph& graph);
+
+    using RouteId = uint64_t;
+
+    struct RouteInfo {
+      RouteId id;
+      Weight weight;
+      size_t edge_count;
+    };
+
+    std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
+    EdgeId GetRouteEdge(RouteId route_id, size_t edge_idx) const;
+    void ReleaseRoute(RouteId route_id);
+
+    size_t GetShortcutCount() const;
+    MemoryUsage GetMemoryUsage() const;  // of the hierarchy
+
+    void Serialize(std::ostream& output) const;
+    // The graph must be the one the hierarchy was built for
+    static ContractionHierarchy Deserialize(const Graph& graph, std::istream& input);
+
+  private:
+    ContractionHierarchy() = default;
+
+    using HierarchyEdgeId = size_t;
+
+    struct HierarchyEdge {
+      VertexId from;
+      VertexId to;
+      Weight weight;
+      bool is_shortcut;
+      EdgeId original_edge_id;  // for edges of the graph
+      HierarchyEdgeId first_part;  // for shortcuts: from -> middle
+      HierarchyEdgeId second_part;  // for shortcuts: middle -> to
+    };
+
+    // Settled vertex limits of a witness search: an unfinished search just adds a shortcut.
+    // Estimating priorities tolerates a rougher search than the contraction itself.
+    static constexpr size_t SIMULATION_WITNESS_SEARCH_LIMIT = 50;
+    static constexpr size_t WITNESS_SEARCH_LIMIT = 500;
+
+    class Contractor;
+
+    struct SearchLabel {
+      Weight distance;
+      std::optional<HierarchyEdgeId> parent_edge;
+    };
+    struct SearchSpace {
+      std::vector<std::optional<SearchLabel>> labels;
+      std::vector<VertexId> touched_vertices;
+
+      void Reset();
+      void Label(VertexId vertex, SearchLabel label);
+    };
+
+    void BuildSearchGraphs(const std::vector<size_t>& ranks);
+    void UnpackEdge(HierarchyEdgeId edge_id, std::vector<EdgeId>& edges) const;
+
+    size_t vertex_count_ = 0;
+    std::vector<HierarchyEdge> edges_;
+    // forward search: edges from v to higher vertices; backward search: edges from higher vertices to v
+    std::vector<size_t> upward_offsets_;
+    std::vector<HierarchyEdgeId> upward_edge_ids_;
+    std::vector<size_t> downward_offsets_;
+    std::vector<HierarchyEdgeId> downward_edge_ids_;
+
+    mutable SearchSpace forward_search_;
+    mutable SearchSpace backward_search_;
+
+    using ExpandedRoute = std::vector<EdgeId>;
+    mutable RouteId next_route_id_ = 0;
+    mutable std::unordered_map<RouteId, ExpandedRoute> expanded_routes_cache_;
+  };
+
+
+  template <typename Weight>
+  class ContractionHierarchy<Weight>::Contractor {
+  public:
+    Contractor(std::vector<HierarchyEdge>& edges, size_t vertex_count)
+        : edges_(edges),
+          outgoing_(vertex_count),
+          incoming_(vertex_count),
+          is_contracted_(vertex_count, false),
+          contracted_neighbour_counts_(vertex_count, 0),
+          witness_distances_(vertex_count),
+          is_witness_target_(vertex_count, false)
+    {
+      for (HierarchyEdgeId edge_id = 0; edge_id < edges_.size(); ++edge_id) {
+        outgoing_[edges_[edge_id].from].push_back(edge_id);
+        incoming_[edges_[edge_id].to].push_back(edge_id);
+      }
+    }
+
+    // Contraction ranks of the vertices
+    std::vector<size_t> Run() {
+      const size_t vertex_count = outgoing_.size();
+      using QueueItem = std::pair<long, VertexId>;
+      std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+      for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+        queue.push({ComputePriority(vertex), vertex});
+      }
+
+      std::vector<size_t> ranks(vertex_count);
+      size_t next_rank = 0;
+      while (!queue.empty()) {
+        const VertexId vertex = queue.top().second;
+        queue.pop();
+        // lazy update: priorities of the rest only grow while their neighbours are contracted
+        const long priority = ComputePriority(vertex);
+        if (!queue.empty() && priority > queue.top().first) {
+          queue.push({priority, vertex});
+          continue;
+        }
+        Contract(vertex, false);
+        ranks[vertex] = next_rank++;
+      }
+      return ranks;
+    }
+
+  private:
+    struct Neighbour {
+      VertexId vertex;
+      HierarchyEdgeId edge_id;
+    };
+
+    // The cheapest edge to every remaining neighbour, in the order of first appearance
+    std::vector<Neighbour> GetNeighbours(const std::vector<HierarchyEdgeId>& edge_ids, VertexId vertex, bool is_outgoing) const {
+      std::vector<Neighbour> neighbours;
+      std::unordered_map<VertexId, size_t> neighbour_indices;
+      for (const HierarchyEdgeId edge_id : edge_ids) {
+        const HierarchyEdge& edge = edges_[edge_id];
+        const VertexId neighbour = is_outgoing ? edge.to : edge.from;
+        if (neighbour == vertex || is_contracted_[neighbour]) {
+          continue;
+        }
+        const auto [it, inserted] = neighbour_indices.try_emplace(neighbour, neighbours.size());
+        if (inserted) {
+          neighbours.push_back({neighbour, edge_id});
+        } else if (edge.weight < edges_[neighbours[it->second].edge_id].weight) {
+          neighbours[it->second].edge_id = edge_id;
+        }
+      }
+      return neighbours;
+    }
+
+    long ComputePriority(VertexId vertex) {
+      const long shortcut_count = Contract(vertex, true);
+      const long removed_edge_count = GetNeighbours(incoming_[vertex], vertex, false).size()
+          + GetNeighbours(outgoing_[vertex], vertex, true).size();
+      return shortcut_count - removed_edge_count + contracted_neighbour_counts_[vertex];
+    }
+
+    // Returns the number of shortcuts needed; adds them unless simulating
+    size_t Contract(VertexId vertex, bool simulate) {
+      const auto sources = GetNeighbours(incoming_[vertex], vertex, false);
+      const auto targets = GetNeighbours(outgoing_[vertex], vertex, true);
+      if (!simulate) {
+        is_contracted_[vertex] = true;
+        for (const auto* neighbours : {&sources, &targets}) {
+          for (const Neighbour& neighbour : *neighbours) {
+            ++contracted_neighbour_counts_[neighbour.vertex];
+          }
+        }
+        // later searches never need edges into the contracted vertex
+        auto is_contracted_edge = [this, vertex](HierarchyEdgeId edge_id) {
+          return edges_[edge_id].from == vertex || edges_[edge_id].to == vertex;
+        };
+        for (const Neighbour& source : sources) {
+          auto& edge_ids = outgoing_[source.vertex];
+          edge_ids.erase(std::remove_if(std::begin(edge_ids), std::end(edge_ids), is_contracted_edge), std::end(edge_ids));
+        }
+        for (const Neighbour& target : targets) {
+          auto& edge_ids = incoming_[target.vertex];
+          edge_ids.erase(std::remove_if(std::begin(edge_ids), std::end(edge_ids), is_contracted_edge), std::end(edge_ids));
+        }
+      }
+      if (sources.empty() || targets.empty()) {
+        return 0;
+      }
+
+      Weight max_target_weight = 0;
+      for (const Neighbour& target : targets) {
+        max_target_weight = std::max(max_target_weight, edges_[target.edge_id].weight);
+      }
+
+      for (const Neighbour& target : targets) {
+        is_witness_target_[target.vertex] = true;
+      }
+      size_t shortcut_count = 0;
+      for (const Neighbour& source : sources) {
+        const Weight source_weight = edges_[source.edge_id].weight;
+        FindWitnesses(source.vertex, vertex, source_weight + max_target_weight, targets.size(),
+                      simulate ? SIMULATION_WITNESS_SEARCH_LIMIT : WITNESS_SEARCH_LIMIT);
+        for (const Neighbour& target : targets) {
+          if (target.vertex == source.vertex) {
+            continue;
+          }
+          const Weight shortcut_weight = source_weight + edges_[target.edge_id].weight;
+          const auto& witness_distance = witness_distances_[target.vertex];
+          if (witness_distance && *witness_distance <= shortcut_weight) {
+            continue;
+          }
+          ++shortcut_count;
+          if (!simulate) {
+            const HierarchyEdgeId shortcut_id = edges_.size();
+            edges_.push_back({source.vertex, target.vertex, shortcut_weight, true, 0, source.edge_id, target.edge_id});
+            outgoing_[source.vertex].push_back(shortcut_id);
+            incoming_[target.vertex].push_back(shortcut_id);
+          }
+        }
+        ResetWitnesses();
+      }
+      for (const Neighbour& target : targets) {
+        is_witness_target_[target.vertex] = false;
+      }
+      return shortcut_count;
+    }
+
+    // Bounded Dijkstra from source over the remaining vertices except the one being contracted;
+    // stops as soon as all targets are settled
+    void FindWitnesses(VertexId source, VertexId excluded, Weight bound, size_t target_count, size_t settled_limit) {
+      using QueueItem = std::pair<Weight, VertexId>;
+      std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+      witness_distances_[source] = 0;
+      touched_vertices_.push_back(source);
+      queue.push({0, source});
+      size_t settled_count = 0;
+      while (!queue.empty() && settled_count < settled_limit) {
+        const auto [distance, vertex] = queue.top();
+        queue.pop();
+        if (distance > *witness_distances_[vertex]) {
+          continue;
+        }
+        ++settled_count;
+        if (is_witness_target_[vertex] && --target_count == 0) {
+          break;
+        }
+        for (const HierarchyEdgeId edge_id : outgoing_[vertex]) {
+          const HierarchyEdge& edge = edges_[edge_id];
+          if (edge.to == excluded) {
+            continue;
+          }
+          const Weight candidate = distance + edge.weight;
+          if (candidate > bound) {
+            continue;
+          }
+          auto& target_distance = witness_distances_[edge.to];
+          if (!target_distance) {
+            touched_vertices_.push_back(edge.to);
+          }
+          if (!target_distance || candidate < *target_distance) {
+            target_distance = candidate;
+            queue.push({candidate, edge.to});
+          }
+        }
+      }
+    }
+
+    void ResetWitnesses() {
+      for (const VertexId vertex : touched_vertices_) {
+        witness_distances_[vertex].reset();
+      }
+      touched_vertices_.clear();
+    }
+
+    std::vector<HierarchyEdge>& edges_;
+    std::vector<std::vector<HierarchyEdgeId>> outgoing_;
+    std::vector<std::vector<HierarchyEdgeId>> incoming_;
+    std::vector<bool> is_contracted_;
+    std::vector<size_t> contracted_neighbour_counts_;
+    std::vector<std::optional<Weight>> witness_distances_;
+    std::vector<bool> is_witness_target_;
+    std::vector<VertexId> touched_vertices_;
+  };
+
+
+  template <typename Weight>
+  ContractionHierarchy<Weight>::ContractionHierarchy(const Graph& graph)
+      : vertex_count_(graph.GetVertexCount())
+  {
+    edges_.reserve(graph.GetEdgeCount());
+    for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+      const auto& edge = graph.GetEdge(edge_id);
+      assert(edge.weight >= 0);
+      if (edge.from != edge.to) {  // loops are never part of a shortest route
+        edges_.push_back({edge.from, edge.to, edge.weight, false, edge_id, 0, 0});
+      }
+    }
+    BuildSearchGraphs(Contractor(edges_, vertex_count_).Run());
+    edges_.shrink_to_fit();
+  }
+
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::BuildSearchGraphs(const std::vector<size_t>& ranks) {
+    std::vector<std::vector<HierarchyEdgeId>> upward(vertex_count_);
+    std::vector<std::vector<HierarchyEdgeId>> downward(vertex_count_);
+    for (HierarchyEdgeId edge_id = 0; edge_id < edges_.size(); ++edge_id) {
+      const HierarchyEdge& edge = edges_[edge_id];
+      if (ranks[edge.from] < ranks[edge.to]) {
+        upward[edge.from].push_back(edge_id);
+      } else {
+        downward[edge.to].push_back(edge_id);
+      }
+    }
+
+    auto flatten = [](const std::vector<std::vector<HierarchyEdgeId>>& lists,
+                      std::vector<size_t>& offsets, std::vector<HierarchyEdgeId>& edge_ids) {
+      offsets.assign(1, 0);
+      for (const auto& list : lists) {
+        edge_ids.insert(std::end(edge_ids), std::begin(list), std::end(list));
+        offsets.push_back(edge_ids.size());
+      }
+    };
+    flatten(upward, upward_offsets_, upward_edge_ids_);
+    flatten(downward, downward_offsets_, downward_edge_ids_);
+
+    forward_search_.labels.resize(vertex_count_);
+    backward_search_.labels.resize(vertex_count_);
+  }
+
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::SearchSpace::Reset() {
+    for (const VertexId vertex : touched_vertices) {
+      labels[vertex].reset();
+    }
+    touched_vertices.clear();
+  }
+
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::SearchSpace::Label(VertexId vertex, SearchLabel label) {
+    if (!labels[vertex]) {
+      touched_vertices.push_back(vertex);
+    }
+    labels[vertex] = label;
+  }
+
+  template <typename Weight>
+  std::optional<typename ContractionHierarchy<Weight>::RouteInfo>
+  ContractionHierarchy<Weight>::BuildRoute(VertexId from, VertexId to) const {
+    forward_search_.Reset();
+    backward_search_.Reset();
+
+    using QueueItem = std::pair<Weight, VertexId>;
+    using Queue = std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>>;
+    Queue forward_queue;
+    Queue backward_queue;
+    forward_search_.Label(from, {0, std::nullopt});
+    forward_queue.push({0, from});
+    backward_search_.Label(to, {0, std::nullopt});
+    backward_queue.push({0, to});
+
+    std::optional<Weight> best_weight;
+    VertexId meeting_vertex = from;
+    while (!forward_queue.empty() || !backward_queue.empty()) {
+      const bool is_forward = backward_queue.empty()
+          || (!forward_queue.empty() && forward_queue.top().first <= backward_queue.top().first);
+      Queue& queue = is_forward ? forward_queue : backward_queue;
+      if (best_weight && queue.top().first >= *best_weight) {
+        break;  // the other queue is not shorter either
+      }
+      const auto [distance, vertex] = queue.top();
+      queue.pop();
+
+      SearchSpace& search = is_forward ? forward_search_ : backward_search_;
+      const SearchSpace& other_search = is_forward ? backward_search_ : forward_search_;
+      if (distance > search.labels[vertex]->distance) {
+        continue;
+      }
+      if (const auto& other_label = other_search.labels[vertex]) {
+        const Weight candidate = distance + other_label->distance;
+        if (!best_weight || candidate < *best_weight) {
+          best_weight = candidate;
+          meeting_vertex = vertex;
+        }
+      }
+
+      const auto& offsets = is_forward ? upward_offsets_ : downward_offsets_;
+      const auto& edge_ids = is_forward ? upward_edge_ids_ : downward_edge_ids_;
+      for (size_t idx = offsets[vertex]; idx < offsets[vertex + 1]; ++idx) {
+        const HierarchyEdge& edge = edges_[edge_ids[idx]];
+        const VertexId next_vertex = is_forward ? edge.to : edge.from;
+        const Weight candidate = distance + edge.weight;
+        const auto& label = search.labels[next_vertex];
+        if (!label || candidate < label->distance) {
+          search.Label(next_vertex, {candidate, edge_ids[idx]});
+          queue.push({candidate, next_vertex});
+        }
+      }
+    }
+    if (!best_weight) {
+      return std::nullopt;
+    }
+
+    std::vector<HierarchyEdgeId> hierarchy_edges;
+    for (VertexId vertex = meeting_vertex; const auto parent_edge = forward_search_.labels[vertex]->parent_edge; ) {
+      hierarchy_edges.push_back(*parent_edge);
+      vertex = edges_[*parent_edge].from;
+    }
+    std::reverse(std::begin(hierarchy_edges), std::end(hierarchy_edges));
+    for (VertexId vertex = meeting_vertex; const auto parent_edge = backward_search_.labels[vertex]->parent_edge; ) {
+      hierarchy_edges.push_back(*parent_edge);
+      vertex = edges_[*parent_edge].to;
+    }
+
+    std::vector<EdgeId> edges;
+    for (const HierarchyEdgeId edge_id : hierarchy_edges) {
+      UnpackEdge(edge_id, edges);
+    }
+
+    const RouteId route_id = next_route_id_++;
+    const size_t route_edge_count = edges.size();
+    expanded_routes_cache_[route_id] = std::move(edges);
+    return RouteInfo{route_id, *best_weight, route_edge_count};
+  }
+
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::UnpackEdge(HierarchyEdgeId edge_id, std::vector<EdgeId>& edges) const {
+    std::vector<HierarchyEdgeId> stack = {edge_id};
+    while (!stack.empty()) {
+      const HierarchyEdge& edge = edges_[stack.back()];
+      stack.pop_back();
+      if (edge.is_shortcut) {
+        stack.push_back(edge.second_part);
+        stack.push_back(edge.first_part);
+      } else {
+        edges.push_back(edge.original_edge_id);
+      }
+    }
+  }
+
+  template <typename Weight>
+  EdgeId ContractionHierarchy<Weight>::GetRouteEdge(RouteId route_id, size_t edge_idx) const {
+    return expanded_routes_cache_.at(route_id)[edge_idx];
+  }
+
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::ReleaseRoute(RouteId route_id) {
+    expanded_routes_cache_.erase(route_id);
+  }
+
+  template <typename Weight>
+  size_t ContractionHierarchy<Weight>::GetShortcutCount() const {
+    return std::count_if(std::begin(edges_), std::end(edges_), [](const HierarchyEdge& edge) {
+      return edge.is_shortcut;
+    });
+  }
+
+  template <typename Weight>
+  MemoryUsage ContractionHierarchy<Weight>::GetMemoryUsage() const {
+    return ComputeMemoryUsage(edges_)
+        + ComputeMemoryUsage(upward_offsets_) + ComputeMemoryUsage(downward_offsets_)
+        + ComputeMemoryUsage(upward_edge_ids_) + ComputeMemoryUsage(downward_edge_ids_);
+  }
+
+  // Binary, for the same build only: no versioning or endianness conversion
+  template <typename Weight>
+  void ContractionHierarchy<Weight>::Serialize(std::ostream& output) const {
+    Detail::WriteVector(output, std::vector<uint64_t>{vertex_count_});
+    Detail::WriteVector(output, edges_);
+    Detail::WriteVector(output, upward_offsets_);
+    Detail::WriteVector(output, upward_edge_ids_);
+    Detail::WriteVector(output, downward_offsets_);
+    Detail::WriteVector(output, downward_edge_ids_);
+  }
+
+  template <typename Weight>
+  ContractionHierarchy<Weight> ContractionHierarchy<Weight>::Deserialize(const Graph& graph, std::istream& input) {
+    ContractionHierarchy result;
+    const auto vertex_count = Detail::ReadVector<uint64_t>(input);
+    if (vertex_count.size() != 1) {
+      throw std::runtime_error("Malformed contraction hierarchy");
+    }
+    result.vertex_count_ = vertex_count.front();
+    result.edges_ = Detail::ReadVector<HierarchyEdge>(input);
+    result.upward_offsets_ = Detail::ReadVector<size_t>(input);
+    result.upward_edge_ids_ = Detail::ReadVector<HierarchyEdgeId>(input);
+    result.downward_offsets_ = Detail::ReadVector<size_t>(input);
+    result.downward_edge_ids_ = Detail::ReadVector<HierarchyEdgeId>(input);
+    if (result.vertex_count_ != graph.GetVertexCount()
+        || result.upward_offsets_.size() != result.vertex_count_ + 1
+        || result.downward_offsets_.size() != result.vertex_count_ + 1) {
+      throw std::runtime_error("Malformed contraction hierarchy");
+    }
+    // shortcuts are added after their parts, which keeps unpacking finite
+    for (HierarchyEdgeId edge_id = 0; edge_id < result.edges_.size(); ++edge_id) {
+      const HierarchyEdge& edge = result.edges_[edge_id];
+      const bool is_valid = edge.from < result.vertex_count_ && edge.to < result.vertex_count_
+          && (edge.is_shortcut ? edge.first_part < edge_id && edge.second_part < edge_id
+                               : edge.original_edge_id < graph.GetEdgeCount());
+      if (!is_valid) {
+        throw std::runtime_error("Malformed contraction hierarchy");
+      }
+    }
+    auto are_lists_valid = [&result](const std::vector<size_t>& offsets, const std::vector<HierarchyEdgeId>& edge_ids) {
+      return offsets.front() == 0 && offsets.back() == edge_ids.size()
+          && std::is_sorted(std::begin(offsets), std::end(offsets))
+          && std::all_of(std::begin(edge_ids), std::end(edge_ids), [&result](HierarchyEdgeId edge_id) {
+               return edge_id < result.edges_.size();
+             });
+    };
+    if (!are_lists_valid(result.upward_offsets_, result.upward_edge_ids_)
+        || !are_lists_valid(result.downward_offsets_, result.downward_edge_ids_)) {
+      throw std::runtime_error("Malformed contraction hierarchy");
+    }
+    result.forward_search_.labels.resize(result.vertex_count_);
+    result.backward_search_.labels.resize(result.vertex_count_);
+    return result;
+  }
+
+}
@@ -1,4 +1,9 @@
 #include "descriptions.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
 
 using namespace std;
 
@@ -20,19 +25,12 @@ namespace Descriptions {
     return stop;
   }
 
-  vector<string> ParseStops(const vector<Json::Node>& stop_nodes, bool is_roundtrip) {
+  vector<string> ParseStops(const vector<Json::Node>& stop_nodes) {
     vector<string> stops;
     stops.reserve(stop_nodes.size());
     for (const Json::Node& stop_node : stop_nodes) {
       stops.push_back(stop_node.AsString());
     }
-    if (is_roundtrip || stops.size() <= 1) {
-      return stops;
-    }
-    stops.reserve(stops.size() * 2 - 1);  // end stop is not repeated
-    for (size_t stop_idx = stops.size() - 1; stop_idx > 0; --stop_idx) {
-      stops.push_back(stops[stop_idx - 1]);
-    }
     return stops;
   }
 
@@ -44,27 +42,105 @@ namespace Descriptions {
     }
   }
 
+  // Either the list of "departures" or a "headway": {"first_departure", "last_departure", "interval"}
+  vector<double> ParseDepartures(const Json::Dict& attrs) {
+    vector<double> departures;
+    if (attrs.count("departures") > 0) {
+      for (const Json::Node& departure_node : attrs.at("departures").AsArray()) {
+        departures.push_back(departure_node.AsDouble());
+      }
+      sort(begin(departures), end(departures));
+    } else if (attrs.count("headway") > 0) {
+      const auto& headway = attrs.at("headway").AsMap();
+      const double first_departure = headway.at("first_departure").AsDouble();
+      const double last_departure = headway.at("last_departure").AsDouble();
+      const double interval = headway.at("interval").AsDouble();
+      if (interval <= 0) {
+        throw runtime_error("Headway interval must be positive");
+      }
+      for (size_t trip_idx = 0; first_departure + trip_idx * interval <= last_departure; ++trip_idx) {
+        departures.push_back(first_departure + trip_idx * interval);
+      }
+    }
+    return departures;
+  }
+
   Bus Bus::ParseFrom(const Json::Dict& attrs) {
     return Bus{
         .name = attrs.at("name").AsString(),
-        .stops = ParseStops(attrs.at("stops").AsArray(), attrs.at("is_roundtrip").AsBool()),
-        .is_roundtrip = attrs.at("is_roundtrip").AsBool()
+        .stops = ParseStops(attrs.at("stops").AsArray()),
+        .is_roundtrip = attrs.at("is_roundtrip").AsBool(),
+        .departures = ParseDepartures(attrs),
     };
   }
 
   vector<InputQuery> ReadDescriptions(const vector<Json::Node>& nodes) {
+    TRACE_SCOPE("ReadDescriptions");
     vector<InputQuery> result;
     result.reserve(nodes.size());
+    // positions in result of the descriptions updates and removals refer to
+    unordered_map<string, size_t> stop_idxs;
+    unordered_map<string, size_t> bus_idxs;
+    vector<bool> is_removed;
+    // number of the buses read so far going through each stop
+    unordered_map<string, size_t> stop_bus_counts;
+    const auto count_bus_stops = [&stop_bus_counts](const Bus& bus, int delta) {
+      vector<string> stop_names = bus.stops;
+      sort(begin(stop_names), end(stop_names));
+      stop_names.erase(unique(begin(stop_names), end(stop_names)), end(stop_names));
+      for (const string& stop_name : stop_names) {
+        stop_bus_counts[stop_name] += delta;
+      }
+    };
 
     for (const Json::Node& node : nodes) {
       const auto& node_dict = node.AsMap();
-      if (node_dict.at("type").AsString() == "Bus") {
-        result.push_back(Bus::ParseFrom(node_dict));
+      const string& type = node_dict.at("type").AsString();
+      const bool is_bus = type == "Bus" || type == "UpdateBus" || type == "RemoveBus";
+      auto& idxs = is_bus ? bus_idxs : stop_idxs;
+      if (type == "RemoveStop" || type == "RemoveBus") {
+        // skipped in the same cases the stat requests answer with an error
+        const auto it = idxs.find(node_dict.at("name").AsString());
+        if (it == idxs.end() || (!is_bus && stop_bus_counts[it->first] > 0)) {
+          continue;
+        }
+        if (is_bus) {
+          count_bus_stops(get<Bus>(result[it->second]), -1);
+        }
+        is_removed.resize(result.size(), false);
+        is_removed[it->second] = true;
+        idxs.erase(it);
+        continue;
+      }
+      InputQuery description = is_bus ? InputQuery(Bus::ParseFrom(node_dict)) : InputQuery(Stop::ParseFrom(node_dict));
+      if (is_bus) {
+        count_bus_stops(get<Bus>(description), 1);
+      }
+      const string& name = visit([](const auto& item) -> const string& { return item.name; }, description);
+      if (auto it = idxs.find(name); it != idxs.end() && (type == "UpdateStop" || type == "UpdateBus")) {
+        if (is_bus) {
+          count_bus_stops(get<Bus>(result[it->second]), -1);
+        }
+        result[it->second] = move(description);
       } else {
-        result.push_back(Stop::ParseFrom(node_dict));
+        idxs[name] = result.size();
+        result.push_back(move(description));
       }
     }
 
+    if (!is_removed.empty()) {
+      is_removed.resize(result.size(), false);
+      size_t kept_count = 0;
+      for (size_t idx = 0; idx < result.size(); ++idx) {
+        if (!is_removed[idx]) {
+          if (kept_count != idx) {
+            result[kept_count] = move(result[idx]);
+          }
+          ++kept_count;
+        }
+      }
+      result.resize(kept_count);
+    }
     return result;
   }
 
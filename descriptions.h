@@ -1,8 +1,11 @@
 #pragma once
 
 #include "json.h"
+#include "memory_usage.h"
 #include "sphere.h"
 
+#include <cstddef>
+#include <iterator>
 #include <string>
 #include <unordered_map>
 #include <variant>
@@ -19,18 +22,78 @@ namespace Descriptions {
 
   int ComputeStopsDistance(const Stop& lhs, const Stop& rhs);
 
-  std::vector<std::string> ParseStops(const std::vector<Json::Node>& stop_nodes, bool is_roundtrip);
+  std::vector<std::string> ParseStops(const std::vector<Json::Node>& stop_nodes);
+  std::vector<double> ParseDepartures(const Json::Dict& attrs);
+
+  // Full route over the stops stored once, as given:
+  // a non-roundtrip bus goes back through them in reverse without repeating the end stop
+  template <typename StopId>
+  class RouteView {
+  public:
+    class Iterator {
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = StopId;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const StopId*;
+      using reference = const StopId&;
+
+      Iterator(RouteView route, size_t idx) : route_(route), idx_(idx) {}
+
+      reference operator*() const { return route_[idx_]; }
+      pointer operator->() const { return &route_[idx_]; }
+      Iterator& operator++() { ++idx_; return *this; }
+      Iterator operator++(int) { Iterator it = *this; ++idx_; return it; }
+      bool operator==(const Iterator& other) const { return idx_ == other.idx_; }
+      bool operator!=(const Iterator& other) const { return idx_ != other.idx_; }
+
+    private:
+      RouteView route_;
+      size_t idx_;
+    };
+
+    RouteView(const std::vector<StopId>& stops, bool is_roundtrip)
+      : stops_(&stops), is_roundtrip_(is_roundtrip) {}
+
+    size_t size() const {
+      return is_roundtrip_ || stops_->empty() ? stops_->size() : stops_->size() * 2 - 1;
+    }
+    bool empty() const { return stops_->empty(); }
+
+    // Index of the far end stop of a non-roundtrip route, where the return leg starts
+    size_t GetTurnIdx() const { return stops_->size() - 1; }
+
+    const StopId& operator[](size_t idx) const {
+      return idx < stops_->size() ? (*stops_)[idx] : (*stops_)[size() - 1 - idx];
+    }
+    const StopId& front() const { return stops_->front(); }
+    const StopId& back() const { return (*this)[size() - 1]; }
+
+    Iterator begin() const { return {*this, 0}; }
+    Iterator end() const { return {*this, size()}; }
+
+  private:
+    const std::vector<StopId>* stops_;
+    bool is_roundtrip_;
+  };
 
   struct Bus {
     std::string name;
-    std::vector<std::string> stops;
+    std::vector<std::string> stops;  // forward stops only, see GetRoute
     bool is_roundtrip;
+    // Timetable: departures from the first stop, in minutes since midnight; empty if the bus has none
+    std::vector<double> departures;
+
+    RouteView<std::string> GetRoute() const { return {stops, is_roundtrip}; }
+
     //Можно лучше: тоже самое что выше
     static Bus ParseFrom(const Json::Dict& attrs);
   };
 
   using InputQuery = std::variant<Stop, Bus>;
 
+  // UpdateStop, UpdateBus, RemoveStop and RemoveBus entries change the descriptions read before them,
+  // as the stat requests of the same types do; removals the stat requests would reject are skipped
   std::vector<InputQuery> ReadDescriptions(const std::vector<Json::Node>& nodes);
 
   template <typename Object>
@@ -39,3 +102,17 @@ namespace Descriptions {
   using StopsDict = Dict<Stop>;
   using BusesDict = Dict<Bus>;
 }
+
+template <>
+struct MemoryUsageOf<Descriptions::Stop> {
+  MemoryUsage operator()(const Descriptions::Stop& stop) const {
+    return ComputeMemoryUsage(stop.name) + ComputeMemoryUsage(stop.distances);
+  }
+};
+
+template <>
+struct MemoryUsageOf<Descriptions::Bus> {
+  MemoryUsage operator()(const Descriptions::Bus& bus) const {
+    return ComputeMemoryUsage(bus.name) + ComputeMemoryUsage(bus.stops) + ComputeMemoryUsage(bus.departures);
+  }
+};
@@ -0,0 +1,250 @@
+#include "golden.h"
+#include "descriptions.h"
+#include "json.h"
+#include "requests.h"
+#include "transport_catalog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+namespace Golden {
+
+  static string ReadFile(const fs::path& path) {
+    ifstream input(path, ios::binary);
+    if (!input) {
+      throw runtime_error("Failed to open " + path.string());
+    }
+    return {istreambuf_iterator<char>(input), istreambuf_iterator<char>()};
+  }
+
+  static Budget ReadBudget(const fs::path& case_dir) {
+    Budget budget;
+    if (!fs::exists(case_dir / "budget.json")) {
+      return budget;
+    }
+    istringstream input(ReadFile(case_dir / "budget.json"));
+    const auto document = Json::Load(input);
+    const auto& budget_map = document.GetRoot().AsMap();
+    if (budget_map.count("max_seconds") > 0) {
+      budget.max_seconds = budget_map.at("max_seconds").AsDouble();
+    }
+    if (budget_map.count("max_memory_mb") > 0) {
+      budget.max_memory_mb = budget_map.at("max_memory_mb").AsDouble();
+    }
+    return budget;
+  }
+
+  static bool IsNumber(const Json::Node& node) {
+    return holds_alternative<int>(node) || holds_alternative<double>(node);
+  }
+
+  static string ToString(const Json::Node& node) {
+    ostringstream output;
+    Json::PrintNode(node, output);
+    string result = output.str();
+    return result.size() > 80 ? result.substr(0, 77) + "..." : result;
+  }
+
+  // Answers print numbers with 6 significant digits, which rounds each side by up to 5e-6 of its value
+  static constexpr double NUMBER_TOLERANCE = 1e-5;
+
+  // Numbers are equal up to the precision they are printed with; dicts, up to the order of keys.
+  // Reports the path of the first difference
+  static bool CompareNodes(const Json::Node& actual, const Json::Node& expected, const string& path,
+                           vector<string>& failures) {
+    auto fail = [&] {
+      failures.push_back("answers differ at " + path + ": " + ToString(actual) + " instead of " + ToString(expected));
+      return false;
+    };
+    if (IsNumber(actual) && IsNumber(expected)) {
+      const double lhs = actual.AsDouble();
+      const double rhs = expected.AsDouble();
+      return abs(lhs - rhs) <= NUMBER_TOLERANCE * max({1.0, abs(lhs), abs(rhs)}) || fail();
+    }
+    if (actual.index() != expected.index()) {
+      return fail();
+    }
+    if (holds_alternative<vector<Json::Node>>(actual)) {
+      const auto& actual_items = actual.AsArray();
+      const auto& expected_items = expected.AsArray();
+      if (actual_items.size() != expected_items.size()) {
+        return fail();
+      }
+      for (size_t idx = 0; idx < actual_items.size(); ++idx) {
+        if (!CompareNodes(actual_items[idx], expected_items[idx], path + "[" + to_string(idx) + "]", failures)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    if (holds_alternative<Json::Dict>(actual)) {
+      const auto& actual_dict = actual.AsMap();
+      const auto& expected_dict = expected.AsMap();
+      for (const auto& [key, expected_value] : expected_dict) {
+        const auto it = actual_dict.find(key);
+        if (it == actual_dict.end()) {
+          failures.push_back("answers differ at " + path + ": no key \"" + key + "\"");
+          return false;
+        }
+        if (!CompareNodes(it->second, expected_value, path + "." + key, failures)) {
+          return false;
+        }
+      }
+      for (const auto& [key, _] : actual_dict) {
+        if (expected_dict.count(key) == 0) {
+          failures.push_back("answers differ at " + path + ": extra key \"" + key + "\"");
+          return false;
+        }
+      }
+      return true;
+    }
+    return actual == expected || fail();
+  }
+
+  static vector<string> CheckCase(const fs::path& case_dir) {
+    istringstream input(ReadFile(case_dir / "in.json"));
+    const auto input_doc = Json::Load(input);
+    const auto& input_map = input_doc.GetRoot().AsMap();
+
+    TransportCatalog db(
+      Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray()),
+      input_map.at("routing_settings").AsMap(),
+      input_map.at("render_settings").AsMap()
+    );
+    const auto& stat_requests = input_map.at("stat_requests").AsArray();
+    Requests::PrepareCatalog(db, stat_requests);
+    ostringstream output;
+    Requests::ProcessAll(db, stat_requests, output);
+
+    vector<string> failures;
+    istringstream actual_input(output.str());
+    istringstream expected_input(ReadFile(case_dir / "control.json"));
+    CompareNodes(Json::Load(actual_input).GetRoot(), Json::Load(expected_input).GetRoot(), "$", failures);
+
+    if (fs::exists(case_dir / "control_map.svg")) {
+      const string actual_map = db.RenderMapDebug();
+      const string expected_map = ReadFile(case_dir / "control_map.svg");
+      if (actual_map != expected_map) {
+        const size_t offset = mismatch(begin(actual_map), end(actual_map), begin(expected_map), end(expected_map)).first
+                              - begin(actual_map);
+        failures.push_back("map differs from byte " + to_string(offset));
+      }
+    }
+    return failures;
+  }
+
+  vector<fs::path> FindCases(const fs::path& root) {
+    vector<fs::path> case_dirs;
+    for (const auto& entry : fs::directory_iterator(root)) {
+      if (entry.is_directory() && fs::exists(entry.path() / "in.json")) {
+        case_dirs.push_back(entry.path());
+      }
+    }
+    sort(begin(case_dirs), end(case_dirs));
+    return case_dirs;
+  }
+
+  CaseResult RunCase(const fs::path& case_dir) {
+    CaseResult result = {.name = case_dir.filename().string()};
+    const Budget budget = ReadBudget(case_dir);
+
+    // the child reports failures one per line through the pipe
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+      throw runtime_error("Failed to create a pipe");
+    }
+    cout.flush();
+    cerr.flush();
+    const auto start_time = chrono::steady_clock::now();
+    const pid_t pid = fork();
+    if (pid < 0) {
+      throw runtime_error("Failed to start a process");
+    }
+    if (pid == 0) {
+      close(pipe_fds[0]);
+      vector<string> failures;
+      try {
+        failures = CheckCase(case_dir);
+      } catch (const exception& e) {
+        failures = {string("exception: ") + e.what()};
+      }
+      string report;
+      for (const string& failure : failures) {
+        report += failure + '\n';
+      }
+      for (size_t written = 0; written < report.size(); ) {
+        const ssize_t count = write(pipe_fds[1], report.data() + written, report.size() - written);
+        if (count <= 0) {
+          break;
+        }
+        written += count;
+      }
+      _exit(0);
+    }
+
+    close(pipe_fds[1]);
+    string report;
+    char buffer[4096];
+    for (ssize_t count; (count = read(pipe_fds[0], buffer, sizeof(buffer))) > 0; ) {
+      report.append(buffer, count);
+    }
+    close(pipe_fds[0]);
+    int status = 0;
+    rusage usage = {};
+    wait4(pid, &status, 0, &usage);
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+    result.memory_mb = usage.ru_maxrss / 1024.0;  // kilobytes on Linux
+
+    istringstream report_input(report);
+    for (string line; getline(report_input, line); ) {
+      result.failures.push_back(move(line));
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      result.failures.push_back(WIFSIGNALED(status) ? "killed by signal " + to_string(WTERMSIG(status))
+                                                    : "exited with " + to_string(WEXITSTATUS(status)));
+    }
+    if (budget.max_seconds && result.seconds > *budget.max_seconds) {
+      result.failures.push_back("time budget exceeded: " + to_string(result.seconds) + " s");
+    }
+    if (budget.max_memory_mb && result.memory_mb > *budget.max_memory_mb) {
+      result.failures.push_back("memory budget exceeded: " + to_string(result.memory_mb) + " MB");
+    }
+    return result;
+  }
+
+  size_t RunAll(const fs::path& root, ostream& output) {
+    const auto case_dirs = fs::is_directory(root) ? FindCases(root) : vector<fs::path>{};
+    if (case_dirs.empty()) {
+      // a mistyped directory must not pass for a green run
+      output << "no cases in " << root.string() << endl;
+      return 1;
+    }
+    size_t failed_count = 0;
+    for (const auto& case_dir : case_dirs) {
+      const CaseResult result = RunCase(case_dir);
+      output << result.name << (result.failures.empty() ? " OK " : " FAIL ") << fixed << setprecision(3)
+             << result.seconds << " s " << setprecision(1) << result.memory_mb << " MB\n";
+      for (const string& failure : result.failures) {
+        output << "  " << failure << '\n';
+      }
+      failed_count += !result.failures.empty();
+    }
+    output << case_dirs.size() << " cases, " << failed_count << " failed" << endl;
+    return failed_count;
+  }
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Regression cases run by main with --golden=DIR: every subdirectory of DIR with an in.json is a case.
+// The answers must equal control.json as JSON values, and the map, if control_map.svg is present,
+// must equal it byte for byte. An optional budget.json, {"max_seconds": ..., "max_memory_mb": ...},
+// limits the wall time and the peak resident memory of the case.
+// The cases of the repository are in golden/: run them with --golden=golden.
+namespace Golden {
+  struct Budget {
+    std::optional<double> max_seconds;
+    std::optional<double> max_memory_mb;
+  };
+
+  struct CaseResult {
+    std::string name;
+    std::vector<std::string> failures;  // empty if the case passed
+    double seconds;
+    double memory_mb;  // peak resident memory of the process that ran the case
+  };
+
+  std::vector<std::filesystem::path> FindCases(const std::filesystem::path& root);
+
+  // Runs the case in a child process, so that its time and memory are measured alone
+  CaseResult RunCase(const std::filesystem::path& case_dir);
+
+  // Prints a line per case; returns the number of failed cases, 1 if there are no cases at all
+  size_t RunAll(const std::filesystem::path& root, std::ostream& output);
+}
@@ -1,9 +1,13 @@
 #pragma once
 
+#include "memory_usage.h"
 #include "utils.h"
 
+#include <cassert>
+#include <cstddef>
 #include <cstdlib>
 #include <deque>
+#include <iterator>
 #include <vector>
 
 namespace Graph {
@@ -18,24 +22,64 @@ namespace Graph {
     Weight weight;
   };
 
+  // Ids of the edges leaving a vertex: positions in its incidence list,
+  // or, once the graph is frozen, the ids themselves
+  class IncidentEdgeIterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = EdgeId;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const EdgeId*;
+    using reference = EdgeId;
+
+    IncidentEdgeIterator(const EdgeId* incidence_list, size_t idx) : incidence_list_(incidence_list), idx_(idx) {}
+
+    EdgeId operator*() const { return incidence_list_ ? incidence_list_[idx_] : idx_; }
+    IncidentEdgeIterator& operator++() {
+      ++idx_;
+      return *this;
+    }
+    IncidentEdgeIterator operator++(int) {
+      IncidentEdgeIterator it = *this;
+      ++idx_;
+      return it;
+    }
+    bool operator==(const IncidentEdgeIterator& other) const { return idx_ == other.idx_; }
+    bool operator!=(const IncidentEdgeIterator& other) const { return idx_ != other.idx_; }
+
+  private:
+    const EdgeId* incidence_list_;  // null for a frozen graph
+    size_t idx_;
+  };
+
   template <typename Weight>
   class DirectedWeightedGraph {
   private:
     using IncidenceList = std::vector<EdgeId>;
-    using IncidentEdgesRange = Range<typename IncidenceList::const_iterator>;
+    using IncidentEdgesRange = Range<IncidentEdgeIterator>;
 
   public:
     DirectedWeightedGraph(size_t vertex_count = 0);
     EdgeId AddEdge(const Edge<Weight>& edge);
 
+    // Packs the graph into compressed sparse rows: edges are renumbered so that the edges
+    // of every vertex are adjacent, and incidence lists become the offsets of their id ranges.
+    // Returns the old id of every edge by its new id. No edges can be added afterwards.
+    std::vector<EdgeId> Freeze();
+    bool IsFrozen() const;
+
     size_t GetVertexCount() const;
     size_t GetEdgeCount() const;
     const Edge<Weight>& GetEdge(EdgeId edge_id) const;
     IncidentEdgesRange GetIncidentEdges(VertexId vertex) const;
+    MemoryUsage GetMemoryUsage() const;
 
   private:
     std::vector<Edge<Weight>> edges_;
     std::vector<IncidenceList> incidence_lists_;
+
+    // frozen graph: edges of vertex v are [incidence_offsets_[v], incidence_offsets_[v + 1])
+    std::vector<EdgeId> incidence_offsets_;
   };
 
 
@@ -44,15 +88,44 @@ namespace Graph {
 
   template <typename Weight>
   EdgeId DirectedWeightedGraph<Weight>::AddEdge(const Edge<Weight>& edge) {
+    assert(!IsFrozen());
     edges_.push_back(edge);
     const EdgeId id = edges_.size() - 1;
     incidence_lists_[edge.from].push_back(id);
     return id;
   }
 
+  template <typename Weight>
+  std::vector<EdgeId> DirectedWeightedGraph<Weight>::Freeze() {
+    assert(!IsFrozen());
+    std::vector<EdgeId> old_edge_ids;
+    old_edge_ids.reserve(edges_.size());
+    incidence_offsets_.reserve(incidence_lists_.size() + 1);
+    incidence_offsets_.push_back(0);
+    for (const IncidenceList& incidence_list : incidence_lists_) {
+      old_edge_ids.insert(std::end(old_edge_ids), std::begin(incidence_list), std::end(incidence_list));
+      incidence_offsets_.push_back(old_edge_ids.size());
+    }
+
+    std::vector<Edge<Weight>> edges;
+    edges.reserve(edges_.size());
+    for (const EdgeId old_edge_id : old_edge_ids) {
+      edges.push_back(edges_[old_edge_id]);
+    }
+    edges_ = std::move(edges);
+    std::vector<IncidenceList>().swap(incidence_lists_);
+
+    return old_edge_ids;
+  }
+
+  template <typename Weight>
+  bool DirectedWeightedGraph<Weight>::IsFrozen() const {
+    return !incidence_offsets_.empty();
+  }
+
   template <typename Weight>
   size_t DirectedWeightedGraph<Weight>::GetVertexCount() const {
-    return incidence_lists_.size();
+    return IsFrozen() ? incidence_offsets_.size() - 1 : incidence_lists_.size();
   }
 
   template <typename Weight>
@@ -68,7 +141,16 @@ namespace Graph {
   template <typename Weight>
   typename DirectedWeightedGraph<Weight>::IncidentEdgesRange
   DirectedWeightedGraph<Weight>::GetIncidentEdges(VertexId vertex) const {
+    if (IsFrozen()) {
+      return {{nullptr, incidence_offsets_[vertex]}, {nullptr, incidence_offsets_[vertex + 1]}};
+    }
     const auto& edges = incidence_lists_[vertex];
-    return {std::begin(edges), std::end(edges)};
+    return {{edges.data(), 0}, {edges.data(), edges.size()}};
+  }
+
+  template <typename Weight>
+  MemoryUsage DirectedWeightedGraph<Weight>::GetMemoryUsage() const {
+    return ComputeMemoryUsage(edges_) + ComputeMemoryUsage(incidence_lists_)
+        + ComputeMemoryUsage(incidence_offsets_);
   }
 }
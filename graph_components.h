@@ -0,0 +1,93 @@
+#pragma once
+
+#include "graph.h"
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+namespace Graph {
+
+  template <typename Weight>
+  struct GraphComponent {
+    DirectedWeightedGraph<Weight> graph;  // frozen
+    std::vector<EdgeId> original_edge_ids;  // by edge id in the component
+  };
+
+  template <typename Weight>
+  struct GraphComponents {
+    std::vector<GraphComponent<Weight>> components;  // by their smallest original vertex
+    struct VertexPosition {
+      size_t component_idx;
+      VertexId vertex_id;  // in the component
+    };
+    std::vector<VertexPosition> vertex_positions;  // by original vertex id
+  };
+
+  // Splits the graph into weakly connected components. Vertices and edges keep their relative order,
+  // so any order-dependent tie-breaking inside a component stays the same as in the whole graph.
+  template <typename Weight>
+  GraphComponents<Weight> SplitIntoComponents(const DirectedWeightedGraph<Weight>& graph) {
+    const size_t vertex_count = graph.GetVertexCount();
+
+    std::vector<VertexId> parents(vertex_count);
+    std::iota(std::begin(parents), std::end(parents), 0);
+    auto find_root = [&parents](VertexId vertex) {
+      while (parents[vertex] != vertex) {
+        vertex = parents[vertex] = parents[parents[vertex]];
+      }
+      return vertex;
+    };
+    for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+      const auto& edge = graph.GetEdge(edge_id);
+      const VertexId from_root = find_root(edge.from);
+      const VertexId to_root = find_root(edge.to);
+      if (from_root != to_root) {
+        parents[std::max(from_root, to_root)] = std::min(from_root, to_root);
+      }
+    }
+
+    GraphComponents<Weight> result;
+    result.vertex_positions.resize(vertex_count);
+    std::vector<size_t> component_vertex_counts;
+    for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+      const VertexId root = find_root(vertex);
+      if (root == vertex) {
+        result.vertex_positions[vertex] = {component_vertex_counts.size(), 0};
+        component_vertex_counts.push_back(1);
+      } else {
+        const size_t component_idx = result.vertex_positions[root].component_idx;
+        result.vertex_positions[vertex] = {component_idx, component_vertex_counts[component_idx]++};
+      }
+    }
+
+    result.components.reserve(component_vertex_counts.size());
+    for (const size_t component_vertex_count : component_vertex_counts) {
+      result.components.push_back({DirectedWeightedGraph<Weight>(component_vertex_count), {}});
+    }
+    for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+      const auto [component_idx, _] = result.vertex_positions[vertex];
+      auto& component = result.components[component_idx];
+      for (const EdgeId edge_id : graph.GetIncidentEdges(vertex)) {
+        const auto& edge = graph.GetEdge(edge_id);
+        component.graph.AddEdge({
+            result.vertex_positions[edge.from].vertex_id,
+            result.vertex_positions[edge.to].vertex_id,
+            edge.weight
+        });
+        component.original_edge_ids.push_back(edge_id);
+      }
+    }
+
+    for (auto& component : result.components) {
+      std::vector<EdgeId> original_edge_ids;
+      original_edge_ids.reserve(component.original_edge_ids.size());
+      for (const EdgeId edge_id : component.graph.Freeze()) {
+        original_edge_ids.push_back(component.original_edge_ids[edge_id]);
+      }
+      component.original_edge_ids = std::move(original_edge_ids);
+    }
+    return result;
+  }
+
+}
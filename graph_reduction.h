@@ -0,0 +1,130 @@
+#pragma once
+
+#include "graph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Graph {
+
+  template <typename Weight>
+  struct ReducedGraph {
+    DirectedWeightedGraph<Weight> graph;
+    std::vector<EdgeId> original_edge_ids;  // by reduced edge id
+  };
+
+  // Keeps shortest paths intact while removing edges no router can ever pick:
+  // - of parallel edges only the first one of minimal weight stays, as Router would choose it;
+  // - an edge is dropped if a chain of other edges between its ends is strictly cheaper.
+  // The search for chains settles at most max_settled_count vertices from each tail, so that
+  // dense networks do not make it all-pairs; an edge it has not proven dominated is kept.
+  template <typename Weight>
+  ReducedGraph<Weight> ReduceGraph(const DirectedWeightedGraph<Weight>& graph, size_t max_settled_count = 1024) {
+    const size_t vertex_count = graph.GetVertexCount();
+
+    // 1. parallel edges
+    std::vector<std::vector<EdgeId>> merged_edges(vertex_count);
+    for (VertexId from = 0; from < vertex_count; ++from) {
+      std::unordered_map<VertexId, size_t> best_edge_idx_by_target;
+      auto& edges = merged_edges[from];
+      for (const EdgeId edge_id : graph.GetIncidentEdges(from)) {
+        const auto& edge = graph.GetEdge(edge_id);
+        const auto [it, inserted] = best_edge_idx_by_target.try_emplace(edge.to, edges.size());
+        if (inserted) {
+          edges.push_back(edge_id);
+          continue;
+        }
+        EdgeId& best_edge_id = edges[it->second];
+        if (edge.weight < graph.GetEdge(best_edge_id).weight) {
+          best_edge_id = edge_id;
+        }
+      }
+    }
+
+    // 2. edges dominated by chains: Dijkstra from every vertex, bounded by its heaviest edge,
+    // until the heads of all its edges are settled
+    std::vector<std::optional<Weight>> distances(vertex_count);
+    std::vector<VertexId> visited;
+    std::vector<bool> is_head(vertex_count, false);
+    std::vector<bool> is_kept(graph.GetEdgeCount(), true);
+    for (VertexId from = 0; from < vertex_count; ++from) {
+      const auto& edges = merged_edges[from];
+      if (edges.size() < 2) {
+        continue;  // a single edge can only be dominated through a cycle back to its tail
+      }
+      Weight bound = 0;
+      for (const EdgeId edge_id : edges) {
+        bound = std::max(bound, graph.GetEdge(edge_id).weight);
+        is_head[graph.GetEdge(edge_id).to] = true;
+      }
+      size_t unsettled_head_count = edges.size();
+      size_t settled_count = 0;
+
+      using QueueItem = std::pair<Weight, VertexId>;
+      std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+      distances[from] = 0;
+      visited.push_back(from);
+      queue.push({0, from});
+      while (!queue.empty() && unsettled_head_count > 0 && settled_count < max_settled_count) {
+        const auto [distance, vertex] = queue.top();
+        queue.pop();
+        if (distance > *distances[vertex]) {
+          continue;
+        }
+        ++settled_count;
+        if (is_head[vertex]) {
+          --unsettled_head_count;
+        }
+        for (const EdgeId edge_id : merged_edges[vertex]) {
+          const auto& edge = graph.GetEdge(edge_id);
+          const Weight candidate = distance + edge.weight;
+          if (candidate > bound) {
+            continue;
+          }
+          auto& target_distance = distances[edge.to];
+          if (!target_distance) {
+            visited.push_back(edge.to);
+          }
+          if (!target_distance || candidate < *target_distance) {
+            target_distance = candidate;
+            queue.push({candidate, edge.to});
+          }
+        }
+      }
+
+      // a distance not yet settled is still the length of some chain, enough to drop an edge
+      for (const EdgeId edge_id : edges) {
+        const auto& edge = graph.GetEdge(edge_id);
+        is_head[edge.to] = false;
+        // sums of the same weights in another order may differ in the last bits
+        const Weight tolerance = std::abs(edge.weight) * 1e-12;
+        if (distances[edge.to] && *distances[edge.to] < edge.weight - tolerance) {
+          is_kept[edge_id] = false;
+        }
+      }
+      for (const VertexId vertex : visited) {
+        distances[vertex].reset();
+      }
+      visited.clear();
+    }
+
+    ReducedGraph<Weight> result{DirectedWeightedGraph<Weight>(vertex_count), {}};
+    for (VertexId from = 0; from < vertex_count; ++from) {
+      for (const EdgeId edge_id : merged_edges[from]) {
+        if (!is_kept[edge_id]) {
+          continue;
+        }
+        result.graph.AddEdge(graph.GetEdge(edge_id));
+        result.original_edge_ids.push_back(edge_id);
+      }
+    }
+    return result;
+  }
+
+}
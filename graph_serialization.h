@@ -0,0 +1,78 @@
+#pragma once
+
+#include "graph.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace Graph {
+
+  // Raw vectors of trivially copyable items for Serialize/Deserialize of the routing engines
+  namespace Detail {
+    template <typename T>
+    void WriteVector(std::ostream& output, const std::vector<T>& items) {
+      static_assert(std::is_trivially_copyable_v<T>);
+      const uint64_t size = items.size();
+      output.write(reinterpret_cast<const char*>(&size), sizeof(size));
+      output.write(reinterpret_cast<const char*>(items.data()), sizeof(T) * items.size());
+    }
+
+    template <typename T>
+    std::vector<T> ReadVector(std::istream& input) {
+      static_assert(std::is_trivially_copyable_v<T>);
+      uint64_t size = 0;
+      input.read(reinterpret_cast<char*>(&size), sizeof(size));
+      // read by chunks so that a corrupted size fails at the end of data instead of allocating it all
+      constexpr uint64_t CHUNK_SIZE = (uint64_t{1} << 20) / sizeof(T) + 1;
+      std::vector<T> items;
+      while (input && items.size() < size) {
+        const size_t read_count = items.size();
+        items.resize(read_count + std::min(size - read_count, CHUNK_SIZE));
+        input.read(reinterpret_cast<char*>(items.data() + read_count), sizeof(T) * (items.size() - read_count));
+      }
+      if (!input) {
+        throw std::runtime_error("Unexpected end of serialized data");
+      }
+      return items;
+    }
+
+    // Vertex and edge counts and a hash of the edges, written ahead of an engine so that
+    // one saved for another graph is rejected on load instead of answering wrong routes
+    template <typename Weight>
+    std::vector<uint64_t> ComputeGraphFingerprint(const DirectedWeightedGraph<Weight>& graph) {
+      static_assert(std::is_trivially_copyable_v<Weight>);
+      uint64_t hash = 14695981039346656037ull;  // FNV-1a
+      auto add_bytes = [&hash](const auto& value) {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(&value);
+        for (size_t idx = 0; idx < sizeof(value); ++idx) {
+          hash = (hash ^ bytes[idx]) * 1099511628211ull;
+        }
+      };
+      for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+        const auto& edge = graph.GetEdge(edge_id);
+        add_bytes(uint64_t{edge.from});
+        add_bytes(uint64_t{edge.to});
+        add_bytes(edge.weight);
+      }
+      return {graph.GetVertexCount(), graph.GetEdgeCount(), hash};
+    }
+
+    template <typename Weight>
+    void WriteGraphFingerprint(std::ostream& output, const DirectedWeightedGraph<Weight>& graph) {
+      WriteVector(output, ComputeGraphFingerprint(graph));
+    }
+
+    template <typename Weight>
+    void CheckGraphFingerprint(std::istream& input, const DirectedWeightedGraph<Weight>& graph) {
+      if (ReadVector<uint64_t>(input) != ComputeGraphFingerprint(graph)) {
+        throw std::runtime_error("Serialized engine belongs to another graph");
+      }
+    }
+  }
+
+}
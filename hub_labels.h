@@ -0,0 +1,422 @@
+#pragma once
+
+#include "graph.h"
+#include "graph_serialization.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <ostream>
+#include <queue>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Graph {
+
+  // Hub labels built by pruned landmark labeling: every vertex keeps the distances to and from
+  // a few hubs, and any shortest route passes through a hub common to its ends. A distance query
+  // merges two sorted labels; a route is restored edge by edge from the parent edges of the labels.
+  // Has the same route API as Router.
+  template <typename Weight>
+  class HubLabels {
+  private:
+    using Graph = DirectedWeightedGraph<Weight>;
+
+  public:
+    explicit HubLabels(const Graph& graph);
+
+    using RouteId = uint64_t;
+
+    struct RouteInfo {
+      RouteId id;
+      Weight weight;
+      size_t edge_count;
+    };
+
+    std::optional<Weight> GetDistance(VertexId from, VertexId to) const;
+
+    std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
+    EdgeId GetRouteEdge(RouteId route_id, size_t edge_idx) const;
+    void ReleaseRoute(RouteId route_id);
+
+    size_t GetLabelEntryCount() const;
+    MemoryUsage GetMemoryUsage() const;  // of the labels
+
+    void Serialize(std::ostream& output) const;
+    // The graph must be the one the labels were built for
+    static HubLabels Deserialize(const Graph& graph, std::istream& input);
+
+  private:
+    using HubRank = uint32_t;
+    // parent edge of the label of the hub itself
+    static constexpr EdgeId NO_EDGE = std::numeric_limits<EdgeId>::max();
+
+    struct LabelEntry {
+      HubRank hub;
+      Weight distance;
+      EdgeId parent_edge;
+    };
+
+    // entries of vertex v are [offsets[v], offsets[v + 1]), sorted by hub rank
+    struct Labels {
+      std::vector<size_t> offsets;
+      std::vector<HubRank> hubs;
+      std::vector<Weight> distances;
+      // out-labels: the first edge from the vertex towards the hub; in-labels: the last edge from the hub
+      std::vector<EdgeId> parent_edges;
+
+      Labels() = default;
+      explicit Labels(const std::vector<std::vector<LabelEntry>>& entries);
+      MemoryUsage GetMemoryUsage() const;
+
+      void Serialize(std::ostream& output) const;
+      static Labels Deserialize(std::istream& input, size_t vertex_count);
+    };
+
+    struct HubMatch {
+      Weight distance;
+      size_t out_entry_idx;
+      size_t in_entry_idx;
+    };
+
+    HubLabels(const Graph& graph, std::vector<VertexId> hub_vertices, Labels out_labels, Labels in_labels)
+        : graph_(graph),
+          hub_vertices_(std::move(hub_vertices)),
+          out_labels_(std::move(out_labels)),
+          in_labels_(std::move(in_labels)) {}
+
+    static std::vector<VertexId> OrderHubs(const Graph& graph);
+    std::optional<HubMatch> FindBestHub(VertexId from, VertexId to) const;
+
+    const Graph& graph_;
+    std::vector<VertexId> hub_vertices_;  // by rank
+    Labels out_labels_;  // distances from the vertex to hubs
+    Labels in_labels_;  // distances from hubs to the vertex
+
+    using ExpandedRoute = std::vector<EdgeId>;
+    mutable RouteId next_route_id_ = 0;
+    mutable std::unordered_map<RouteId, ExpandedRoute> expanded_routes_cache_;
+
+    class Builder;
+  };
+
+
+  template <typename Weight>
+  class HubLabels<Weight>::Builder {
+  public:
+    Builder(const Graph& graph, const std::vector<VertexId>& hub_vertices)
+        : graph_(graph),
+          incoming_edges_(graph.GetVertexCount()),
+          out_entries_(graph.GetVertexCount()),
+          in_entries_(graph.GetVertexCount()),
+          hub_distances_(hub_vertices.size()),
+          distances_(graph.GetVertexCount()),
+          parent_edges_(graph.GetVertexCount(), NO_EDGE)
+    {
+      for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+        incoming_edges_[graph.GetEdge(edge_id).to].push_back(edge_id);
+      }
+      for (HubRank rank = 0; rank < hub_vertices.size(); ++rank) {
+        // distances from the hub: new in-labels, pruned by routes through more important hubs
+        RunPrunedSearch(rank, hub_vertices[rank], true);
+        // distances to the hub: new out-labels
+        RunPrunedSearch(rank, hub_vertices[rank], false);
+      }
+    }
+
+    const std::vector<std::vector<LabelEntry>>& GetOutEntries() const { return out_entries_; }
+    const std::vector<std::vector<LabelEntry>>& GetInEntries() const { return in_entries_; }
+
+  private:
+    void RunPrunedSearch(HubRank rank, VertexId hub_vertex, bool is_forward) {
+      // the labels of the hub on the other side of the routes being checked
+      const auto& hub_entries = is_forward ? out_entries_[hub_vertex] : in_entries_[hub_vertex];
+      for (const LabelEntry& entry : hub_entries) {
+        hub_distances_[entry.hub] = entry.distance;
+      }
+      auto& labelled_entries = is_forward ? in_entries_ : out_entries_;
+
+      using QueueItem = std::pair<Weight, VertexId>;
+      std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+      distances_[hub_vertex] = 0;
+      touched_vertices_.push_back(hub_vertex);
+      queue.push({0, hub_vertex});
+      while (!queue.empty()) {
+        const auto [distance, vertex] = queue.top();
+        queue.pop();
+        if (distance > *distances_[vertex]) {
+          continue;
+        }
+        auto& entries = labelled_entries[vertex];
+        const bool is_covered = std::any_of(std::begin(entries), std::end(entries), [&](const LabelEntry& entry) {
+          return hub_distances_[entry.hub] && *hub_distances_[entry.hub] + entry.distance <= distance;
+        });
+        if (is_covered) {
+          continue;
+        }
+        entries.push_back({rank, distance, parent_edges_[vertex]});
+
+        const auto relax = [&](EdgeId edge_id) {
+          const auto& edge = graph_.GetEdge(edge_id);
+          const VertexId next_vertex = is_forward ? edge.to : edge.from;
+          const Weight candidate = distance + edge.weight;
+          auto& next_distance = distances_[next_vertex];
+          if (!next_distance) {
+            touched_vertices_.push_back(next_vertex);
+          }
+          if (!next_distance || candidate < *next_distance) {
+            next_distance = candidate;
+            parent_edges_[next_vertex] = edge_id;
+            queue.push({candidate, next_vertex});
+          }
+        };
+        if (is_forward) {
+          for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+            relax(edge_id);
+          }
+        } else {
+          for (const EdgeId edge_id : incoming_edges_[vertex]) {
+            relax(edge_id);
+          }
+        }
+      }
+
+      for (const VertexId vertex : touched_vertices_) {
+        distances_[vertex].reset();
+        parent_edges_[vertex] = NO_EDGE;
+      }
+      touched_vertices_.clear();
+      for (const LabelEntry& entry : hub_entries) {
+        hub_distances_[entry.hub].reset();
+      }
+    }
+
+    const Graph& graph_;
+    std::vector<std::vector<EdgeId>> incoming_edges_;
+    std::vector<std::vector<LabelEntry>> out_entries_;
+    std::vector<std::vector<LabelEntry>> in_entries_;
+
+    std::vector<std::optional<Weight>> hub_distances_;  // by hub rank
+    std::vector<std::optional<Weight>> distances_;
+    std::vector<EdgeId> parent_edges_;
+    std::vector<VertexId> touched_vertices_;
+  };
+
+
+  template <typename Weight>
+  HubLabels<Weight>::Labels::Labels(const std::vector<std::vector<LabelEntry>>& entries) {
+    size_t entry_count = 0;
+    for (const auto& vertex_entries : entries) {
+      entry_count += vertex_entries.size();
+    }
+    offsets.reserve(entries.size() + 1);
+    hubs.reserve(entry_count);
+    distances.reserve(entry_count);
+    parent_edges.reserve(entry_count);
+    offsets.push_back(0);
+    for (const auto& vertex_entries : entries) {
+      for (const LabelEntry& entry : vertex_entries) {
+        hubs.push_back(entry.hub);
+        distances.push_back(entry.distance);
+        parent_edges.push_back(entry.parent_edge);
+      }
+      offsets.push_back(hubs.size());
+    }
+  }
+
+  template <typename Weight>
+  MemoryUsage HubLabels<Weight>::Labels::GetMemoryUsage() const {
+    return ComputeMemoryUsage(offsets) + ComputeMemoryUsage(hubs)
+        + ComputeMemoryUsage(distances) + ComputeMemoryUsage(parent_edges);
+  }
+
+  template <typename Weight>
+  std::vector<VertexId> HubLabels<Weight>::OrderHubs(const Graph& graph) {
+    // vertices of high degree cover more routes, so they become hubs first
+    const size_t vertex_count = graph.GetVertexCount();
+    std::vector<size_t> degrees(vertex_count, 0);
+    for (EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+      const auto& edge = graph.GetEdge(edge_id);
+      ++degrees[edge.from];
+      ++degrees[edge.to];
+    }
+    std::vector<VertexId> vertices(vertex_count);
+    std::iota(std::begin(vertices), std::end(vertices), 0);
+    std::stable_sort(std::begin(vertices), std::end(vertices), [&degrees](VertexId lhs, VertexId rhs) {
+      return degrees[lhs] > degrees[rhs];
+    });
+    return vertices;
+  }
+
+  template <typename Weight>
+  HubLabels<Weight>::HubLabels(const Graph& graph)
+      : graph_(graph),
+        hub_vertices_(OrderHubs(graph))
+  {
+    const Builder builder(graph, hub_vertices_);
+    out_labels_ = Labels(builder.GetOutEntries());
+    in_labels_ = Labels(builder.GetInEntries());
+  }
+
+  template <typename Weight>
+  std::optional<typename HubLabels<Weight>::HubMatch> HubLabels<Weight>::FindBestHub(VertexId from, VertexId to) const {
+    std::optional<HubMatch> result;
+    size_t out_idx = out_labels_.offsets[from];
+    const size_t out_end = out_labels_.offsets[from + 1];
+    size_t in_idx = in_labels_.offsets[to];
+    const size_t in_end = in_labels_.offsets[to + 1];
+    while (out_idx < out_end && in_idx < in_end) {
+      const HubRank out_hub = out_labels_.hubs[out_idx];
+      const HubRank in_hub = in_labels_.hubs[in_idx];
+      if (out_hub < in_hub) {
+        ++out_idx;
+      } else if (in_hub < out_hub) {
+        ++in_idx;
+      } else {
+        const Weight distance = out_labels_.distances[out_idx] + in_labels_.distances[in_idx];
+        if (!result || distance < result->distance) {
+          result = HubMatch{distance, out_idx, in_idx};
+        }
+        ++out_idx;
+        ++in_idx;
+      }
+    }
+    return result;
+  }
+
+  template <typename Weight>
+  std::optional<Weight> HubLabels<Weight>::GetDistance(VertexId from, VertexId to) const {
+    if (from == to) {
+      return 0;
+    }
+    const auto match = FindBestHub(from, to);
+    return match ? std::optional<Weight>(match->distance) : std::nullopt;
+  }
+
+  template <typename Weight>
+  std::optional<typename HubLabels<Weight>::RouteInfo> HubLabels<Weight>::BuildRoute(VertexId from, VertexId to) const {
+    const std::optional<Weight> weight = GetDistance(from, to);
+    if (!weight) {
+      return std::nullopt;
+    }
+
+    // every step takes the first edge towards the best hub, or the last edge from it,
+    // and the rest of the route is a shortest one again
+    std::vector<EdgeId> edges;
+    std::vector<EdgeId> reversed_tail;
+    for (VertexId head = from, tail = to; head != tail; ) {
+      const HubMatch match = *FindBestHub(head, tail);
+      if (hub_vertices_[out_labels_.hubs[match.out_entry_idx]] != head) {
+        const EdgeId edge_id = out_labels_.parent_edges[match.out_entry_idx];
+        edges.push_back(edge_id);
+        head = graph_.GetEdge(edge_id).to;
+      } else {
+        const EdgeId edge_id = in_labels_.parent_edges[match.in_entry_idx];
+        reversed_tail.push_back(edge_id);
+        tail = graph_.GetEdge(edge_id).from;
+      }
+      assert(edges.size() + reversed_tail.size() <= graph_.GetVertexCount());
+    }
+    edges.insert(std::end(edges), std::rbegin(reversed_tail), std::rend(reversed_tail));
+
+    const RouteId route_id = next_route_id_++;
+    const size_t route_edge_count = edges.size();
+    expanded_routes_cache_[route_id] = std::move(edges);
+    return RouteInfo{route_id, *weight, route_edge_count};
+  }
+
+  template <typename Weight>
+  EdgeId HubLabels<Weight>::GetRouteEdge(RouteId route_id, size_t edge_idx) const {
+    return expanded_routes_cache_.at(route_id)[edge_idx];
+  }
+
+  template <typename Weight>
+  void HubLabels<Weight>::ReleaseRoute(RouteId route_id) {
+    expanded_routes_cache_.erase(route_id);
+  }
+
+  template <typename Weight>
+  size_t HubLabels<Weight>::GetLabelEntryCount() const {
+    return out_labels_.hubs.size() + in_labels_.hubs.size();
+  }
+
+  template <typename Weight>
+  MemoryUsage HubLabels<Weight>::GetMemoryUsage() const {
+    return ComputeMemoryUsage(hub_vertices_) + out_labels_.GetMemoryUsage() + in_labels_.GetMemoryUsage();
+  }
+
+  template <typename Weight>
+  void HubLabels<Weight>::Labels::Serialize(std::ostream& output) const {
+    Detail::WriteVector(output, offsets);
+    Detail::WriteVector(output, hubs);
+    Detail::WriteVector(output, distances);
+    Detail::WriteVector(output, parent_edges);
+  }
+
+  template <typename Weight>
+  typename HubLabels<Weight>::Labels HubLabels<Weight>::Labels::Deserialize(std::istream& input, size_t vertex_count) {
+    Labels labels;
+    labels.offsets = Detail::ReadVector<size_t>(input);
+    labels.hubs = Detail::ReadVector<HubRank>(input);
+    labels.distances = Detail::ReadVector<Weight>(input);
+    labels.parent_edges = Detail::ReadVector<EdgeId>(input);
+    if (labels.offsets.size() != vertex_count + 1
+        || labels.offsets.front() != 0
+        || labels.offsets.back() != labels.hubs.size()
+        || !std::is_sorted(std::begin(labels.offsets), std::end(labels.offsets))
+        || labels.distances.size() != labels.hubs.size()
+        || labels.parent_edges.size() != labels.hubs.size()
+        || std::any_of(std::begin(labels.hubs), std::end(labels.hubs), [vertex_count](HubRank hub) { return hub >= vertex_count; })) {
+      throw std::runtime_error("Malformed hub labels");
+    }
+    return labels;
+  }
+
+  // Binary, for the same build only: no versioning or endianness conversion
+  template <typename Weight>
+  void HubLabels<Weight>::Serialize(std::ostream& output) const {
+    Detail::WriteVector(output, hub_vertices_);
+    out_labels_.Serialize(output);
+    in_labels_.Serialize(output);
+  }
+
+  template <typename Weight>
+  HubLabels<Weight> HubLabels<Weight>::Deserialize(const Graph& graph, std::istream& input) {
+    auto hub_vertices = Detail::ReadVector<VertexId>(input);
+    if (hub_vertices.size() != graph.GetVertexCount()
+        || std::any_of(std::begin(hub_vertices), std::end(hub_vertices), [&graph](VertexId vertex) { return vertex >= graph.GetVertexCount(); })) {
+      throw std::runtime_error("Malformed hub labels");
+    }
+    auto out_labels = Labels::Deserialize(input, graph.GetVertexCount());
+    auto in_labels = Labels::Deserialize(input, graph.GetVertexCount());
+    // routes are unpacked edge by edge from the ends, so a parent edge must start (end) at its vertex,
+    // and only the label of a vertex as its own hub has none
+    auto are_parent_edges_valid = [&graph, &hub_vertices](const Labels& labels, bool is_out) {
+      for (VertexId vertex = 0; vertex < graph.GetVertexCount(); ++vertex) {
+        for (size_t entry_idx = labels.offsets[vertex]; entry_idx < labels.offsets[vertex + 1]; ++entry_idx) {
+          const EdgeId edge_id = labels.parent_edges[entry_idx];
+          const bool is_valid = edge_id == NO_EDGE
+              ? hub_vertices[labels.hubs[entry_idx]] == vertex
+              : edge_id < graph.GetEdgeCount()
+                  && (is_out ? graph.GetEdge(edge_id).from : graph.GetEdge(edge_id).to) == vertex;
+          if (!is_valid) {
+            return false;
+          }
+        }
+      }
+      return true;
+    };
+    if (!are_parent_edges_valid(out_labels, true) || !are_parent_edges_valid(in_labels, false)) {
+      throw std::runtime_error("Malformed hub labels");
+    }
+    return HubLabels(graph, std::move(hub_vertices), std::move(out_labels), std::move(in_labels));
+  }
+
+}
@@ -1,4 +1,9 @@
 #include "json.h"
+#include "trace.h"
+
+#include <cmath>
+#include <cstdint>
+#include <sstream>
 
 using namespace std;
 
@@ -36,22 +41,83 @@ namespace Json {
       int_part *= 10;
       int_part += input.get() - '0';
     }
-    if (input.peek() != '.') {
+    if (input.peek() != '.' && input.peek() != 'e' && input.peek() != 'E') {
       return Node(int_part * (is_negative ? -1 : 1));
     }
-    input.get();  // '.'
     double result = int_part;
-    double frac_mult = 0.1;
-    while (isdigit(input.peek())) {
-      result += frac_mult * (input.get() - '0');
-      frac_mult /= 10;
+    if (input.peek() == '.') {
+      input.get();
+      double frac_mult = 0.1;
+      while (isdigit(input.peek())) {
+        result += frac_mult * (input.get() - '0');
+        frac_mult /= 10;
+      }
+    }
+    // the exponent of the numbers printed in scientific notation, such as 1e-05
+    if (input.peek() == 'e' || input.peek() == 'E') {
+      input.get();
+      int exponent = 0;
+      input >> exponent;
+      result *= pow(10.0, exponent);
     }
     return Node(result * (is_negative ? -1 : 1));
   }
 
+  static size_t CountTrailingBackslashes(const string& line) {
+    const size_t last_other = line.find_last_not_of('\\');
+    return line.size() - (last_other == string::npos ? 0 : last_other + 1);
+  }
+
+  static void AppendUtf8(uint32_t code_point, string& output) {
+    if (code_point < 0x80) {
+      output.push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+      output.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+      output.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+      output.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+      output.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      output.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+  }
+
+  static string Unescape(const string& line) {
+    string result;
+    result.reserve(line.size());
+    for (size_t pos = 0; pos < line.size(); ++pos) {
+      if (line[pos] != '\\' || pos + 1 == line.size()) {
+        result.push_back(line[pos]);
+        continue;
+      }
+      switch (const char c = line[++pos]) {
+        case 'n': result.push_back('\n'); break;
+        case 't': result.push_back('\t'); break;
+        case 'r': result.push_back('\r'); break;
+        case 'b': result.push_back('\b'); break;
+        case 'f': result.push_back('\f'); break;
+        case 'u':
+          AppendUtf8(stoul(line.substr(pos + 1, 4), nullptr, 16), result);
+          pos += 4;
+          break;
+        default: result.push_back(c);  // \", \\ and \/
+      }
+    }
+    return result;
+  }
+
+  // Escaped quotes, as in the maps of the answers, do not end the string
   Node LoadString(istream& input) {
     string line;
     getline(input, line, '"');
+    while (input && CountTrailingBackslashes(line) % 2 == 1) {
+      string rest;
+      getline(input, rest, '"');
+      line += '"';
+      line += rest;
+    }
+    if (line.find('\\') != string::npos) {
+      line = Unescape(line);
+    }
     return Node(move(line));
   }
 
@@ -92,6 +158,7 @@ namespace Json {
   }
 
   Document Load(istream& input) {
+    TRACE_SCOPE("Json::Load");
     return Document{LoadNode(input)};
   }
 
@@ -145,4 +212,70 @@ namespace Json {
     PrintNode(document.GetRoot(), output);
   }
 
+  pair<string, string> PrintAroundKey(const Dict& dict, const string& key) {
+    ostringstream before_value;
+    ostringstream after_value;
+    before_value << '{';
+    const auto key_position = dict.lower_bound(key);
+    for (auto it = dict.begin(); it != key_position; ++it) {
+      PrintValue(it->first, before_value);
+      before_value << ": ";
+      PrintNode(it->second, before_value);
+      before_value << ", ";
+    }
+    PrintValue(key, before_value);
+    before_value << ": ";
+    for (auto it = key_position; it != dict.end(); ++it) {
+      after_value << ", ";
+      PrintValue(it->first, after_value);
+      after_value << ": ";
+      PrintNode(it->second, after_value);
+    }
+    after_value << '}';
+    return {before_value.str(), after_value.str()};
+  }
+
+  namespace {
+    uint64_t HashBytes(const void* data, size_t size, uint64_t hash) {
+      for (const char* byte = static_cast<const char*>(data); size > 0; ++byte, --size) {
+        hash ^= static_cast<unsigned char>(*byte);
+        hash *= 1099511628211ull;
+      }
+      return hash;
+    }
+
+    uint64_t HashString(const string& value, uint64_t hash) {
+      const uint64_t size = value.size();
+      return HashBytes(value.data(), value.size(), HashBytes(&size, sizeof(size), hash));
+    }
+  }
+
+  uint64_t ComputeHash(const Node& node, uint64_t hash) {
+    // the type tag keeps apart values of the same bytes, the sizes keep apart different nestings
+    const char type = "lmbnns"[node.index()];  // list, map, bool, number, number, string
+    hash = HashBytes(&type, sizeof(type), hash);
+    if (holds_alternative<vector<Node>>(node)) {
+      const uint64_t size = node.AsArray().size();
+      hash = HashBytes(&size, sizeof(size), hash);
+      for (const Node& item : node.AsArray()) {
+        hash = ComputeHash(item, hash);
+      }
+    } else if (holds_alternative<Dict>(node)) {
+      const uint64_t size = node.AsMap().size();
+      hash = HashBytes(&size, sizeof(size), hash);
+      for (const auto& [key, value] : node.AsMap()) {
+        hash = ComputeHash(value, HashString(key, hash));
+      }
+    } else if (holds_alternative<bool>(node)) {
+      const bool value = node.AsBool();
+      hash = HashBytes(&value, sizeof(value), hash);
+    } else if (holds_alternative<string>(node)) {
+      hash = HashString(node.AsString(), hash);
+    } else {
+      const double value = node.AsDouble();
+      hash = HashBytes(&value, sizeof(value), hash);
+    }
+    return hash;
+  }
+
 }
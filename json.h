@@ -1,5 +1,8 @@
 #pragma once
 
+#include "memory_usage.h"
+
+#include <cstdint>
 #include <iostream>
 #include <map>
 #include <string>
@@ -64,5 +67,25 @@ namespace Json {
 
   void Print(const Document& document, std::ostream& output);
 
+  // The dict as Print would output it with one more key, split where the value of that key goes:
+  // answers prepared once are completed with a different value each time
+  std::pair<std::string, std::string> PrintAroundKey(const Dict& dict, const std::string& key);
+
+  // FNV-1a over the value: the same for any key order in the input and for 40 and 40.0
+  uint64_t ComputeHash(const Node& node, uint64_t hash = 14695981039346656037ull);
+
 }
 
+template <>
+struct MemoryUsageOf<Json::Node> {
+  MemoryUsage operator()(const Json::Node& node) const {
+    return ComputeMemoryUsage(node.GetBase());
+  }
+};
+
+template <>
+struct MemoryUsageOf<Json::Document> {
+  MemoryUsage operator()(const Json::Document& document) const {
+    return ComputeMemoryUsage(document.GetRoot());
+  }
+};
@@ -1,185 +1,235 @@
-#include "test_runner.h"
+#include "bench.h"
+#include "build_cache.h"
 #include "descriptions.h"
+#include "golden.h"
 #include "json.h"
+#include "memory_usage.h"
 #include "requests.h"
 #include "sphere.h"
+#include "trace.h"
 #include "transport_catalog.h"
 #include "utils.h"
 
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
 #include <fstream>
-#include <functional>
+#include <optional>
+#include <sstream>
+#include <string_view>
+
+#include <sys/resource.h>
 
 using namespace std;
 
-void MapTest1() {
-
-	fstream is("MapTest1\\in.json", ios_base::in);
-	if (!is.is_open()) {
-		throw runtime_error("MapTest1. failed to open in.json");
-	}
-
-	fstream os("MapTest1\\out.json", ios_base::in | ios_base::out | ios_base::trunc);
-	if (!os.is_open()) {
-		throw runtime_error("MapTest1. failed to open out.json");
-	}
-
-	fstream svgs("MapTest1\\map.svg", ios_base::in | ios_base::out | ios_base::trunc);
-	if (!svgs.is_open()) {
-		throw runtime_error("MapTest1. failed to open map.svg");
-	}
-
-	fstream control("MapTest1\\control.json", ios_base::in);
-	if (!control.is_open()) {
-		throw runtime_error("MapTest1. failed to open control.json");
-	}
-
-	fstream control_map("MapTest1\\control_map.svg", ios_base::in);
-	if (!control.is_open()) {
-		throw runtime_error("MapTest1. failed to open control_map.svg");
-	}
-
-	const auto input_doc = Json::Load(is);
-	const auto& input_map = input_doc.GetRoot().AsMap();
-
-	const TransportCatalog db(
-		Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray()),
-		input_map.at("routing_settings").AsMap(),
-		input_map.at("render_settings").AsMap()
-	);
-
-	Json::PrintValue(
-		Requests::ProcessAll(db, input_map.at("stat_requests").AsArray()),
-		os
-	);
-	os << endl;
-	os.seekp(0);
-
-	svgs << db.RenderMapDebug();
-
-	const Json::Node dest_node = Json::Load(os).GetRoot();
-	const Json::Node exp_node = Json::Load(control).GetRoot();
-	if (!(dest_node == exp_node)) {
-		throw runtime_error("Output and control is not equal");
-	}
-
-	const string out_map_str = db.RenderMapDebug();
-	std::string cont_map_sring((std::istreambuf_iterator<char>(control_map)),
-		std::istreambuf_iterator<char>());
-	if (out_map_str != cont_map_sring) {
-		throw runtime_error("Map and control is not equal");
-	}
-	
+uintmax_t ParseCacheSizeMb(string_view value, string_view source) {
+  uintmax_t size_mb = 0;
+  const auto [end, error] = from_chars(value.data(), value.data() + value.size(), size_mb);
+  if (value.empty() || error != errc() || end != value.data() + value.size() || size_mb > UINTMAX_MAX / (1024 * 1024)) {
+    throw invalid_argument("Invalid " + string(source) + " \"" + string(value) + "\": expected a number of megabytes");
+  }
+  return size_mb;
 }
 
-void MapTest2() {
-
-	fstream is("MapTest2\\in.json", ios_base::in);
-	if (!is.is_open()) {
-		throw runtime_error("MapTest2. failed to open in.json");
-	}
-
-	fstream os("MapTest2\\out.json", ios_base::in | ios_base::out | ios_base::trunc);
-	if (!os.is_open()) {
-		throw runtime_error("MapTest2. failed to open out.json");
-	}
-
-	fstream svgs("MapTest2\\map.svg", ios_base::in | ios_base::out | ios_base::trunc);
-	if (!svgs.is_open()) {
-		throw runtime_error("MapTest2. failed to open map.svg");
-	}
-
-	fstream control("MapTest2\\control.json", ios_base::in);
-	if (!control.is_open()) {
-		throw runtime_error("MapTest2. failed to open control.json");
-	}
-
-	fstream control_map("MapTest2\\control_map.svg", ios_base::in);
-	if (!control.is_open()) {
-		throw runtime_error("MapTest2. failed to open control_map.svg");
-	}
-
-	const auto input_doc = Json::Load(is);
-	const auto& input_map = input_doc.GetRoot().AsMap();
-
-	const TransportCatalog db(
-		Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray()),
-		input_map.at("routing_settings").AsMap(),
-		input_map.at("render_settings").AsMap()
-	);
-
-	Json::PrintValue(
-		Requests::ProcessAll(db, input_map.at("stat_requests").AsArray()),
-		os
-	);
-	os << endl;
-	os.seekp(0);
-
-	svgs << db.RenderMapDebug();
-
-	//const Json::Node dest_node = Json::Load(os).GetRoot();
-	//const Json::Node exp_node = Json::Load(control).GetRoot();
-	//if (!(dest_node == exp_node)) {
-	//	throw runtime_error("Output and control is not equal");
-	//}
-
-	const string out_map_str = db.RenderMapDebug();
-	std::string cont_map_sring((std::istreambuf_iterator<char>(control_map)),
-		std::istreambuf_iterator<char>());
-	if (out_map_str != cont_map_sring) {
-		throw runtime_error("Map and control is not equal");
-	}
+// Build artifacts are looked up in the cache directory given by --cache-dir=DIR or TRANSPORT_CACHE_DIR,
+// limited by --cache-size-mb=N or TRANSPORT_CACHE_SIZE_MB; without a directory nothing is cached
+optional<BuildCache> MakeBuildCache(int argc, char* argv[]) {
+  string directory;
+  uintmax_t size_limit_mb = 512;
+  if (const char* value = getenv("TRANSPORT_CACHE_DIR")) {
+    directory = value;
+  }
+  if (const char* value = getenv("TRANSPORT_CACHE_SIZE_MB")) {
+    size_limit_mb = ParseCacheSizeMb(value, "TRANSPORT_CACHE_SIZE_MB");
+  }
+  for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+    const string_view arg = argv[arg_idx];
+    if (arg.substr(0, 12) == "--cache-dir=") {
+      directory = arg.substr(12);
+    } else if (arg.substr(0, 16) == "--cache-size-mb=") {
+      size_limit_mb = ParseCacheSizeMb(arg.substr(16), "--cache-size-mb");
+    } else if (arg.substr(0, 8) == "--trace=" || arg == "--memory-stats") {
+      continue;  // see GetTracePath, IsMemoryStatsEnabled
+    } else {
+      throw invalid_argument("Unknown argument: " + string(arg));
+    }
+  }
+  if (directory.empty()) {
+    return nullopt;
+  }
+  return BuildCache(directory, size_limit_mb * 1024 * 1024);
+}
 
+// --bench [--bench-time=SECONDS] [--bench-baseline=FILE] [--bench-tolerance=FRACTION]:
+// prints the micro-benchmark results or, with a baseline, their change; fails on regressions.
+// B/op is measured only in builds with -DTRANSPORT_BENCH_ALLOCATIONS, see bench.h
+int RunBenchmarks(int argc, char* argv[]) {
+  double min_seconds = 0.2;
+  optional<string> baseline_path;
+  double tolerance = 0.1;
+  for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+    const string_view arg = argv[arg_idx];
+    if (arg == "--bench") {
+      continue;
+    } else if (arg.substr(0, 13) == "--bench-time=") {
+      min_seconds = stod(string(arg.substr(13)));
+    } else if (arg.substr(0, 17) == "--bench-baseline=") {
+      baseline_path = string(arg.substr(17));
+    } else if (arg.substr(0, 18) == "--bench-tolerance=") {
+      tolerance = stod(string(arg.substr(18)));
+    } else {
+      throw invalid_argument("Unknown argument: " + string(arg));
+    }
+  }
+
+#ifndef TRANSPORT_BENCH_ALLOCATIONS
+  cerr << "Allocations are not counted, build with -DTRANSPORT_BENCH_ALLOCATIONS" << endl;
+#endif
+  const auto results = Bench::RunAll(min_seconds);
+  if (!baseline_path) {
+    Bench::PrintResults(results, cout);
+    return 0;
+  }
+  ifstream baseline_input(*baseline_path);
+  if (!baseline_input) {
+    throw runtime_error("Failed to open " + *baseline_path);
+  }
+  const size_t regression_count = Bench::CompareResults(results, Bench::ReadResults(baseline_input), tolerance, cout);
+  return regression_count > 0 ? 1 : 0;
 }
 
-void TestAll() {
-	TestRunner tr;
-	tr.RunTest(MapTest1, "Map test 1");
-	tr.RunTest(MapTest2, "Map test 2");
+// Trace events are written to the file given by --trace=FILE or TRANSPORT_TRACE_FILE, see trace.h
+optional<string> GetTracePath(int argc, char* argv[]) {
+  optional<string> path;
+  if (const char* value = getenv("TRANSPORT_TRACE_FILE")) {
+    path = value;
+  }
+  for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+    const string_view arg = argv[arg_idx];
+    if (arg.substr(0, 8) == "--trace=") {
+      path = string(arg.substr(8));
+    }
+  }
+  return path;
 }
 
-class MyClass {
-public:
-	MyClass() : caller({ {"ue", std::bind(&MyClass::Foo, this)} }) {
-		caller.at("ue")();
-		//function<void()> fff = std::bind(&MyClass::Foo, this);
-		//caller["au"] = std::bind(&MyClass::Foo, this);
-		//cout << "uh";
-	}
-	
-private:
-	void Foo() {
-		std::cout << "Foo!" << std::endl;
-	}
-	const std::map<string, function<void()>> caller;
-};
-
-int main() {
-
-	//MyClass m;
-	////std::function<void()> f = std::bind(&MyClass::Foo, &m);
-	////f();
-	//return 0;
-
-	//setlocale(LC_ALL, "rus");
-	//cout.precision(6);
-	//TestAll();
-	//return 0;
+// --memory-stats or TRANSPORT_MEMORY_STATS: the estimated memory of the input and of the catalog once it is built
+// is logged to stderr; the MemoryStats request reports it later on, with the router and the map
+bool IsMemoryStatsEnabled(int argc, char* argv[]) {
+  if (getenv("TRANSPORT_MEMORY_STATS")) {
+    return true;
+  }
+  for (int arg_idx = 1; arg_idx < argc; ++arg_idx) {
+    if (string_view(argv[arg_idx]) == "--memory-stats") {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PrintMemoryStats(const vector<SubsystemMemory>& stats, ostream& output) {
+  output << "memory (estimated):";
+  for (const auto& subsystem : stats) {
+    output << ' ' << subsystem.name << ' ' << subsystem.current.estimated_bytes / 1024 << " KB in "
+           << subsystem.current.estimated_allocations << " allocations";
+    if (subsystem.peak.estimated_bytes != subsystem.current.estimated_bytes
+        || subsystem.peak.estimated_allocations != subsystem.current.estimated_allocations) {
+      output << " (peak " << subsystem.peak.estimated_bytes / 1024 << " KB in "
+             << subsystem.peak.estimated_allocations << " allocations)";
+    }
+    output << ',';
+  }
+  rusage usage = {};
+  getrusage(RUSAGE_SELF, &usage);
+  output << " peak RSS " << usage.ru_maxrss << " KB" << endl;  // kilobytes on Linux
+}
+
+// The engines are serialized raw (see router.h), so the key carries the layout of the artifact,
+// format_version, and what the raw layout depends on besides it: the pointer size and the compiler
+string MakeCacheKey(uint64_t hash, const string& kind, uint32_t format_version) {
+  static const uint64_t ABI_HASH = Json::ComputeHash(Json::Node(
+      to_string(sizeof(void*))
+#ifdef __VERSION__
+      + ' ' + __VERSION__
+#endif
+  ));
+  ostringstream key;
+  key << setw(16) << setfill('0') << hex << hash << '-' << kind << '-' << dec << format_version
+      << '-' << hex << setw(16) << ABI_HASH;
+  return key.str();
+}
+
+int main(int argc, char* argv[]) {
+  if (argc > 1 && string_view(argv[1]) == "--bench") {
+    return RunBenchmarks(argc, argv);
+  }
+  // --golden=DIR: runs the regression cases in the subdirectories of DIR, see golden.h
+  if (argc > 1 && string_view(argv[1]).substr(0, 9) == "--golden=") {
+    return Golden::RunAll(string_view(argv[1]).substr(9), cout) > 0 ? 1 : 0;
+  }
+
+  if (const auto trace_path = GetTracePath(argc, argv)) {
+#ifdef TRANSPORT_TRACE
+    Trace::Start(*trace_path);
+#else
+    cerr << "Tracing is not compiled in, build with -DTRANSPORT_TRACE" << endl;
+#endif
+  }
 
   const auto input_doc = Json::Load(cin);
   const auto& input_map = input_doc.GetRoot().AsMap();
 
-  const TransportCatalog db(
+  // the router depends on the base data and the routing settings only, the map on the render settings
+  optional<BuildCache> cache;
+  try {
+    cache = MakeBuildCache(argc, argv);
+  } catch (const invalid_argument& error) {
+    cerr << error.what() << endl;
+    return 1;
+  }
+  const uint64_t base_hash = Json::ComputeHash(input_map.at("base_requests"));
+  const string router_key = MakeCacheKey(Json::ComputeHash(input_map.at("routing_settings"), base_hash), "router",
+                                         Graph::FORMAT_VERSION);
+  const string map_key = MakeCacheKey(Json::ComputeHash(input_map.at("render_settings"), base_hash), "map",
+                                      TransportMap::FORMAT_VERSION);
+  TransportCatalog::Artifacts cached_artifacts;
+  if (cache) {
+    cached_artifacts = {cache->Load(router_key), cache->Load(map_key)};
+  }
+
+  TransportCatalog db(
     Descriptions::ReadDescriptions(input_map.at("base_requests").AsArray()),
     input_map.at("routing_settings").AsMap(),
-	input_map.at("render_settings").AsMap()
-  );
-  std::cerr << "buh" << endl;
-  Json::PrintValue(
-    Requests::ProcessAll(db, input_map.at("stat_requests").AsArray()),
-    cout
+    input_map.at("render_settings").AsMap(),
+    cached_artifacts
   );
+  if (IsMemoryStatsEnabled(argc, argv)) {
+    const MemoryUsage json_dom = ComputeMemoryUsage(input_doc);
+    vector<SubsystemMemory> stats = {{"json_dom", json_dom, json_dom}};
+    for (auto& subsystem : db.GetMemoryStats()) {
+      stats.push_back(move(subsystem));
+    }
+    PrintMemoryStats(stats, cerr);
+  }
+  const auto& stat_requests = input_map.at("stat_requests").AsArray();
+  Requests::PrepareCatalog(db, stat_requests);
+  Requests::ProcessAll(db, stat_requests, cout);
   cout << endl;
 
+  if (cache) {
+    const auto built_artifacts = db.GetArtifacts();
+    if (built_artifacts.router) {
+      cache->Store(router_key, *built_artifacts.router);
+    }
+    if (built_artifacts.map) {
+      cache->Store(map_key, *built_artifacts.map);
+    }
+  }
+
+#ifdef TRANSPORT_TRACE
+  Trace::Finish();
+#endif
   return 0;
 }
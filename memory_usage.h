@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Heap memory owned by a data structure, estimated by walking it: bytes requested from the allocator
+// and the number of allocations. Nothing is counted at the allocator, so the numbers are approximate:
+// sizes of container nodes follow the libstdc++ layouts, and what a type does not report is missed.
+struct MemoryUsage {
+  size_t estimated_bytes = 0;
+  size_t estimated_allocations = 0;
+
+  MemoryUsage& operator+=(const MemoryUsage& other) {
+    estimated_bytes += other.estimated_bytes;
+    estimated_allocations += other.estimated_allocations;
+    return *this;
+  }
+};
+
+inline MemoryUsage operator+(MemoryUsage lhs, const MemoryUsage& rhs) {
+  return lhs += rhs;
+}
+
+// The peak of each counter on its own: the most bytes and the most allocations need not coincide
+inline MemoryUsage MaxOfEach(const MemoryUsage& lhs, const MemoryUsage& rhs) {
+  return {std::max(lhs.estimated_bytes, rhs.estimated_bytes),
+          std::max(lhs.estimated_allocations, rhs.estimated_allocations)};
+}
+
+// Specialized for the types that own heap memory and have no GetMemoryUsage();
+// the primary template is for the ones that own none, so have nothing to free
+template <typename T, typename = void>
+struct MemoryUsageOf {
+  static_assert(std::is_trivially_destructible_v<T>, "MemoryUsageOf is not specialized for a type owning memory");
+  MemoryUsage operator()(const T&) const { return {}; }
+};
+
+template <typename T>
+struct MemoryUsageOf<T, std::void_t<decltype(std::declval<const T&>().GetMemoryUsage())>> {
+  MemoryUsage operator()(const T& value) const { return value.GetMemoryUsage(); }
+};
+
+template <typename T>
+MemoryUsage ComputeMemoryUsage(const T& value) {
+  return MemoryUsageOf<T>{}(value);
+}
+
+// One allocation of count objects
+template <typename T>
+MemoryUsage ComputeArrayUsage(size_t count) {
+  return count > 0 ? MemoryUsage{count * sizeof(T), 1} : MemoryUsage{};
+}
+
+template <typename It>
+MemoryUsage ComputeItemsUsage(It begin, It end) {
+  MemoryUsage result;
+  for (It it = begin; it != end; ++it) {
+    result += ComputeMemoryUsage(*it);
+  }
+  return result;
+}
+
+template <>
+struct MemoryUsageOf<std::string> {
+  MemoryUsage operator()(const std::string& value) const {
+    // short strings are kept inside the object
+    const char* object = reinterpret_cast<const char*>(&value);
+    if (value.data() >= object && value.data() < object + sizeof(value)) {
+      return {};
+    }
+    return ComputeArrayUsage<char>(value.capacity() + 1);
+  }
+};
+
+template <typename T>
+struct MemoryUsageOf<std::vector<T>> {
+  MemoryUsage operator()(const std::vector<T>& values) const {
+    return ComputeArrayUsage<T>(values.capacity()) + ComputeItemsUsage(values.begin(), values.end());
+  }
+};
+
+template <typename T>
+struct MemoryUsageOf<std::deque<T>> {
+  MemoryUsage operator()(const std::deque<T>& values) const {
+    // blocks of 512 bytes, or of one object if it is larger, and the array of pointers to them
+    const size_t block_size = sizeof(T) < 512 ? 512 / sizeof(T) : 1;
+    const size_t block_count = values.size() / block_size + 1;
+    return MemoryUsage{block_count * block_size * sizeof(T), block_count}
+        + ComputeArrayUsage<T*>(std::max<size_t>(8, block_count + 2))
+        + ComputeItemsUsage(values.begin(), values.end());
+  }
+};
+
+// Nodes of unordered containers also keep the hash, unless it is cheap to compute
+template <typename Value, bool IsHashCached>
+struct HashNode {
+  void* next;
+  Value value;
+  size_t hash;
+};
+
+template <typename Value>
+struct HashNode<Value, false> {
+  void* next;
+  Value value;
+};
+
+template <typename Container>
+MemoryUsage ComputeHashTableUsage(const Container& container) {
+  using Key = typename Container::key_type;
+  using Node = HashNode<typename Container::value_type,
+                        !(std::is_arithmetic_v<Key> || std::is_pointer_v<Key> || std::is_enum_v<Key>)>;
+  // a table of one bucket needs no allocation
+  return (container.bucket_count() > 1 ? ComputeArrayUsage<void*>(container.bucket_count()) : MemoryUsage{})
+      + MemoryUsage{container.size() * sizeof(Node), container.size()}
+      + ComputeItemsUsage(container.begin(), container.end());
+}
+
+template <typename K, typename V, typename Hash>
+struct MemoryUsageOf<std::unordered_map<K, V, Hash>> {
+  MemoryUsage operator()(const std::unordered_map<K, V, Hash>& map) const {
+    return ComputeHashTableUsage(map);
+  }
+};
+
+template <typename K, typename Hash>
+struct MemoryUsageOf<std::unordered_set<K, Hash>> {
+  MemoryUsage operator()(const std::unordered_set<K, Hash>& set) const {
+    return ComputeHashTableUsage(set);
+  }
+};
+
+template <typename K, typename V, typename Compare>
+struct MemoryUsageOf<std::map<K, V, Compare>> {
+  MemoryUsage operator()(const std::map<K, V, Compare>& map) const {
+    // color and three links of the red-black tree
+    struct Node {
+      int color;
+      void* links[3];
+      std::pair<const K, V> value;
+    };
+    return MemoryUsage{map.size() * sizeof(Node), map.size()} + ComputeItemsUsage(map.begin(), map.end());
+  }
+};
+
+template <typename First, typename Second>
+struct MemoryUsageOf<std::pair<First, Second>> {
+  MemoryUsage operator()(const std::pair<First, Second>& value) const {
+    return ComputeMemoryUsage(value.first) + ComputeMemoryUsage(value.second);
+  }
+};
+
+template <typename T>
+struct MemoryUsageOf<std::optional<T>> {
+  MemoryUsage operator()(const std::optional<T>& value) const {
+    return value ? ComputeMemoryUsage(*value) : MemoryUsage{};
+  }
+};
+
+template <typename T>
+struct MemoryUsageOf<std::unique_ptr<T>> {
+  MemoryUsage operator()(const std::unique_ptr<T>& value) const {
+    return value ? ComputeArrayUsage<T>(1) + ComputeMemoryUsage(*value) : MemoryUsage{};
+  }
+};
+
+template <typename... Ts>
+struct MemoryUsageOf<std::variant<Ts...>> {
+  MemoryUsage operator()(const std::variant<Ts...>& value) const {
+    return std::visit([](const auto& alternative) { return ComputeMemoryUsage(alternative); }, value);
+  }
+};
+
+// Memory of a part of the program once it is built, and at the peak of its build
+struct SubsystemMemory {
+  std::string name;
+  MemoryUsage current;
+  MemoryUsage peak;
+};
@@ -1,8 +1,12 @@
 #include "requests.h"
+#include "trace.h"
 #include "transport_router.h"
 
+#include <limits>
 #include <vector>
 
+#include <sys/resource.h>
+
 using namespace std;
 
 namespace Requests {
@@ -13,12 +17,7 @@ namespace Requests {
     if (!stop) {
       dict["error_message"] = Json::Node("not found"s);
     } else {
-      vector<Json::Node> bus_nodes;
-      bus_nodes.reserve(stop->bus_names.size());
-      for (const auto& bus_name : stop->bus_names) {
-        bus_nodes.emplace_back(bus_name);
-      }
-      dict["buses"] = Json::Node(move(bus_nodes));
+      dict = Responses::ToJson(*stop);
     }
     return dict;
   }
@@ -29,39 +28,73 @@ namespace Requests {
     if (!bus) {
       dict["error_message"] = Json::Node("not found"s);
     } else {
-      dict = {
-          {"stop_count", Json::Node(static_cast<int>(bus->stop_count))},
-          {"unique_stop_count", Json::Node(static_cast<int>(bus->unique_stop_count))},
-          {"route_length", Json::Node(bus->road_route_length)},
-          {"curvature", Json::Node(bus->road_route_length / bus->geo_route_length)},
-      };
+      dict = Responses::ToJson(*bus);
     }
     return dict;
   }
 
+  // Stop and Bus answers are spliced from the bytes the catalog prepared at build time
+  static void PrintPreparedResponse(const TransportCatalog& db, const Json::Dict& attrs, ostream& output) {
+    static const auto NOT_FOUND_RESPONSE = Json::PrintAroundKey({{"error_message", Json::Node("not found"s)}}, "request_id");
+    // everything that may throw comes before the first byte
+    const string& name = attrs.at("name").AsString();
+    const int request_id = attrs.at("id").AsInt();
+    const auto response = attrs.at("type").AsString() == "Stop"
+        ? db.GetPreparedStopResponse(name)
+        : db.GetPreparedBusResponse(name);
+    output << (response ? response->before_request_id : NOT_FOUND_RESPONSE.first);
+    Json::PrintValue(request_id, output);
+    output << (response ? response->after_request_id : NOT_FOUND_RESPONSE.second);
+  }
+
   struct RouteItemResponseBuilder {
     Json::Dict operator()(const TransportRouter::RouteInfo::BusItem& bus_item) const {
-      return Json::Dict{
+      Json::Dict dict = {
           {"type", Json::Node("Bus"s)},
           {"bus", Json::Node(bus_item.bus_name)},
           {"time", Json::Node(bus_item.time)},
           {"span_count", Json::Node(static_cast<int>(bus_item.span_count))}
       };
+      AddTimestamps(bus_item, dict);
+      return dict;
     }
     Json::Dict operator()(const TransportRouter::RouteInfo::WaitItem& wait_item) const {
-      return Json::Dict{
+      Json::Dict dict = {
           {"type", Json::Node("Wait"s)},
           {"stop_name", Json::Node(wait_item.stop_name)},
           {"time", Json::Node(wait_item.time)},
       };
+      AddTimestamps(wait_item, dict);
+      return dict;
+    }
+
+    template <typename Item>
+    static void AddTimestamps(const Item& item, Json::Dict& dict) {
+      if (item.departure_time) {
+        dict["departure_time"] = Json::Node(*item.departure_time);
+      }
+      if (item.arrival_time) {
+        dict["arrival_time"] = Json::Node(*item.arrival_time);
+      }
     }
   };
 
   Json::Dict Route::Process(const TransportCatalog& db) const {
     Json::Dict dict;
-    const auto route = db.FindRoute(stop_from, stop_to);
+    if (total_time_only && !departure_time) {
+      if (const auto total_time = db.FindRouteTime(stop_from, stop_to)) {
+        dict["total_time"] = Json::Node(*total_time);
+      } else {
+        dict["error_message"] = Json::Node("not found"s);
+      }
+      return dict;
+    }
+
+    const auto route = departure_time ? db.FindRoute(stop_from, stop_to, *departure_time) : db.FindRoute(stop_from, stop_to);
     if (!route) {
       dict["error_message"] = Json::Node("not found"s);
+    } else if (total_time_only) {
+      dict["total_time"] = Json::Node(route->total_time);
     } else {
       dict["total_time"] = Json::Node(route->total_time);
       vector<Json::Node> items;
@@ -71,6 +104,9 @@ namespace Requests {
       }
 
       dict["items"] = move(items);
+      if (render_map) {
+        dict["map"] = Json::Node(db.RenderRoute(*route));
+      }
     }
 
     return dict;
@@ -78,11 +114,106 @@ namespace Requests {
 
   Json::Dict Map::Process(const TransportCatalog& db) const {
     Json::Dict dict;
-    dict["map"] = Json::Node(db.RenderMap());
+    if (viewport) {
+      dict["map"] = Json::Node(layers ? db.RenderMap(*viewport, *layers) : db.RenderMap(*viewport));
+    } else {
+      dict["map"] = Json::Node(layers ? db.RenderMap(*layers) : db.RenderMap());
+    }
+    return dict;
+  }
+
+  Json::Dict NearestStops::Process(const TransportCatalog& db) const {
+    Json::Dict dict;
+    if (count < 0) {
+      dict["error_message"] = Json::Node("count must not be negative"s);
+      return dict;
+    }
+    if (!(radius >= 0)) {
+      dict["error_message"] = Json::Node("radius must not be negative"s);
+      return dict;
+    }
+    vector<Json::Node> stop_nodes;
+    for (const auto& item : db.FindNearestStops(position, static_cast<size_t>(count), radius)) {
+      stop_nodes.push_back(Json::Dict{
+          {"stop_name", Json::Node(*item.stop_name)},
+          {"distance", Json::Node(item.distance)},
+      });
+    }
+    dict["stops"] = Json::Node(move(stop_nodes));
+    return dict;
+  }
+
+  Json::Dict RouterStats::Process(const TransportCatalog& db) const {
+    const auto stats = db.GetRouterStats();
+    return Json::Dict{
+        {"engine", Json::Node(stats.engine)},
+        {"vertex_count", Json::Node(static_cast<int>(stats.vertex_count))},
+        {"edge_count", Json::Node(static_cast<int>(stats.edge_count))},
+        {"component_count", Json::Node(static_cast<int>(stats.component_count))},
+        {"engine_memory_kb", Json::Node(static_cast<int>(stats.engine_memory / 1024))},
+    };
+  }
+
+  Json::Dict MemoryStats::Process(TransportCatalog& db) const {
+    Json::Dict subsystems;
+    for (const auto& subsystem : db.GetMemoryStats()) {
+      subsystems[subsystem.name] = Json::Node(Json::Dict{
+          {"estimated_kb", Json::Node(static_cast<int>(subsystem.current.estimated_bytes / 1024))},
+          {"estimated_allocations", Json::Node(static_cast<int>(subsystem.current.estimated_allocations))},
+          {"estimated_peak_kb", Json::Node(static_cast<int>(subsystem.peak.estimated_bytes / 1024))},
+          {"estimated_peak_allocations", Json::Node(static_cast<int>(subsystem.peak.estimated_allocations))},
+      });
+    }
+    rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return Json::Dict{
+        {"subsystems", Json::Node(move(subsystems))},
+        {"peak_rss_kb", Json::Node(static_cast<int>(usage.ru_maxrss))},  // kilobytes on Linux
+    };
+  }
+
+  Json::Dict UpdateStop::Process(TransportCatalog& db) const {
+    db.UpdateStop(stop);
+    return {};
+  }
+
+  Json::Dict UpdateBus::Process(TransportCatalog& db) const {
+    Json::Dict dict;
+    for (const string& stop_name : bus.stops) {
+      if (!db.GetStop(stop_name)) {
+        dict["error_message"] = Json::Node("unknown stop"s);
+        return dict;
+      }
+    }
+    db.UpdateBus(bus);
     return dict;
   }
 
-  variant<Stop, Bus, Route, Map> Read(const Json::Dict& attrs) {
+  Json::Dict RemoveStop::Process(TransportCatalog& db) const {
+    const auto* stop = db.GetStop(name);
+    Json::Dict dict;
+    if (!stop) {
+      dict["error_message"] = Json::Node("not found"s);
+    } else if (!stop->bus_names.empty()) {
+      dict["error_message"] = Json::Node("stop is used by buses"s);
+    } else {
+      db.RemoveStop(name);
+    }
+    return dict;
+  }
+
+  Json::Dict RemoveBus::Process(TransportCatalog& db) const {
+    Json::Dict dict;
+    if (!db.GetBus(name)) {
+      dict["error_message"] = Json::Node("not found"s);
+    } else {
+      db.RemoveBus(name);
+    }
+    return dict;
+  }
+
+  variant<Stop, Bus, Route, Map, NearestStops, RouterStats, MemoryStats,
+          UpdateStop, UpdateBus, RemoveStop, RemoveBus> Read(const Json::Dict& attrs) {
 	  const string& type = attrs.at("type").AsString();
 	  if (type == "Bus") {
 		  return Bus{ attrs.at("name").AsString() };
@@ -91,28 +222,162 @@ namespace Requests {
 		  return Stop{ attrs.at("name").AsString() };
 	  }
 	  else if (type == "Route") {
-		  return Route{ attrs.at("from").AsString(), attrs.at("to").AsString() };
+		  return Route{
+			  attrs.at("from").AsString(),
+			  attrs.at("to").AsString(),
+			  attrs.count("render_map") > 0 && attrs.at("render_map").AsBool(),
+			  attrs.count("total_time_only") > 0 && attrs.at("total_time_only").AsBool(),
+			  attrs.count("departure_time") > 0 ? optional(attrs.at("departure_time").AsDouble()) : nullopt
+		  };
 	  }
 	  else if (type == "Map") {
-		  return Map{};
+		  Map map;
+		  if (attrs.count("layers") > 0) {
+			  map.layers.emplace();
+			  for (const auto& layer_node : attrs.at("layers").AsArray()) {
+				  map.layers->push_back(layer_node.AsString());
+			  }
+		  }
+		  if (attrs.count("viewport") > 0) {
+			  const auto& viewport_attrs = attrs.at("viewport").AsMap();
+			  auto read_optional = [&viewport_attrs](const string& key) -> optional<double> {
+				  if (auto it = viewport_attrs.find(key); it != viewport_attrs.end()) {
+					  return it->second.AsDouble();
+				  }
+				  return nullopt;
+			  };
+			  map.viewport = TransportMap::Viewport{
+				  .min = { viewport_attrs.at("min_latitude").AsDouble(), viewport_attrs.at("min_longitude").AsDouble() },
+				  .max = { viewport_attrs.at("max_latitude").AsDouble(), viewport_attrs.at("max_longitude").AsDouble() },
+				  .width = read_optional("width"),
+				  .height = read_optional("height"),
+			  };
+		  }
+		  return map;
+      }
+      else if (type == "NearestStops") {
+          return NearestStops{
+              .position = {
+                  .latitude = attrs.at("latitude").AsDouble(),
+                  .longitude = attrs.at("longitude").AsDouble(),
+              },
+              .count = attrs.count("count") ? attrs.at("count").AsInt() : 1,
+              .radius = attrs.count("radius") ? attrs.at("radius").AsDouble() : numeric_limits<double>::infinity(),
+          };
+      }
+      else if (type == "RouterStats") {
+          return RouterStats{};
+      }
+      else if (type == "MemoryStats") {
+          return MemoryStats{};
+      }
+      else if (type == "UpdateStop") {
+          return UpdateStop{ Descriptions::Stop::ParseFrom(attrs) };
+      }
+      else if (type == "UpdateBus") {
+          return UpdateBus{ Descriptions::Bus::ParseFrom(attrs) };
+      }
+      else if (type == "RemoveStop") {
+          return RemoveStop{ attrs.at("name").AsString() };
+      }
+      else if (type == "RemoveBus") {
+          return RemoveBus{ attrs.at("name").AsString() };
       }
       else {
           throw runtime_error("Unknown type of request: " + type);
       }
   }
 
-  vector<Json::Node> ProcessAll(const TransportCatalog& db, const vector<Json::Node>& requests) {
+  static Json::Node ProcessRequest(TransportCatalog& db, const Json::Node& request_node) {
+    Json::Dict dict = visit([&db](const auto& request) {
+                              return request.Process(db);
+                            },
+                            Requests::Read(request_node.AsMap()));
+    dict["request_id"] = Json::Node(request_node.AsMap().at("id").AsInt());
+    return Json::Node(move(dict));
+  }
+
+  // A request that fails is answered with the error, so that the other requests still get their answers
+  static Json::Node MakeErrorResponse(const Json::Node& request_node, const exception& error) {
+    Json::Dict dict = {{"error_message", Json::Node(string(error.what()))}};
+    if (holds_alternative<Json::Dict>(request_node)) {
+      const auto& attrs = request_node.AsMap();
+      if (const auto it = attrs.find("id"); it != attrs.end() && holds_alternative<int>(it->second)) {
+        dict["request_id"] = it->second;
+      }
+    }
+    return Json::Node(move(dict));
+  }
+
+  vector<Json::Node> ProcessAll(TransportCatalog& db, const vector<Json::Node>& requests) {
     vector<Json::Node> responses;
     responses.reserve(requests.size());
     for (const Json::Node& request_node : requests) {
-      Json::Dict dict = visit([&db](const auto& request) {
-                                return request.Process(db);
-                              },
-                              Requests::Read(request_node.AsMap()));
-      dict["request_id"] = Json::Node(request_node.AsMap().at("id").AsInt());
-      responses.push_back(Json::Node(dict));
+      try {
+        TRACE_SCOPE("Request " + request_node.AsMap().at("type").AsString());
+        responses.push_back(ProcessRequest(db, request_node));
+      } catch (const exception& error) {
+        responses.push_back(MakeErrorResponse(request_node, error));
+      }
     }
     return responses;
   }
 
+  void PrepareCatalog(const TransportCatalog& db, const vector<Json::Node>& requests) {
+    for (const Json::Node& request_node : requests) {
+      if (!holds_alternative<Json::Dict>(request_node)) {
+        continue;  // answered with an error by ProcessAll
+      }
+      const auto& attrs = request_node.AsMap();
+      const auto type_it = attrs.find("type");
+      if (type_it == attrs.end() || !holds_alternative<string>(type_it->second)) {
+        continue;
+      }
+      const string& type = type_it->second.AsString();
+      if (type == "Route" || type == "RouterStats") {
+        if (attrs.count("departure_time") == 0) {
+          db.PrepareRouter();  // the timetable router is cheap to build on demand
+        }
+        if (attrs.count("render_map") > 0 && attrs.at("render_map").AsBool()) {
+          db.PrepareMap();
+        }
+      } else if (type == "Map") {
+        if (attrs.count("layers") > 0 || attrs.count("viewport") > 0) {
+          db.PrepareMap();
+        } else {
+          db.PrepareWholeMap();
+        }
+      }
+    }
+  }
+
+  void ProcessAll(TransportCatalog& db, const vector<Json::Node>& requests, ostream& output) {
+    output << '[';
+    bool first = true;
+    for (const Json::Node& request_node : requests) {
+      if (!first) {
+        output << ", ";
+      }
+      first = false;
+      // an answer is printed only once it is complete, so a failed request leaves the array well-formed
+      try {
+        const string& type = request_node.AsMap().at("type").AsString();
+        TRACE_SCOPE("Request " + type);
+        if (type == "Stop" || type == "Bus") {
+          PrintPreparedResponse(db, request_node.AsMap(), output);
+          continue;
+        }
+        if (type == "Route" || type == "Map" || type == "RouterStats" || type == "MemoryStats"
+            || type == "UpdateStop" || type == "UpdateBus" || type == "RemoveStop" || type == "RemoveBus") {
+          // the answer may wait for the router or the map to be built
+          output.flush();
+        }
+        Json::PrintNode(ProcessRequest(db, request_node), output);
+      } catch (const exception& error) {
+        Json::PrintNode(MakeErrorResponse(request_node, error), output);
+      }
+    }
+    output << ']';
+  }
+
 }
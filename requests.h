@@ -1,8 +1,10 @@
 #pragma once
 
+#include "descriptions.h"
 #include "json.h"
 #include "transport_catalog.h"
 
+#include <optional>
 #include <string>
 #include <variant>
 
@@ -23,15 +25,72 @@ namespace Requests {
   struct Route {
     std::string stop_from;
     std::string stop_to;
+    bool render_map = false;  // add the map with the itinerary to the answer
+    bool total_time_only = false;  // answer without the items
+    std::optional<double> departure_time;  // in minutes since midnight: the route over the bus timetables
 
     Json::Dict Process(const TransportCatalog& db) const;
   };
 
   struct Map {
+    std::optional<TransportMap::Viewport> viewport;
+    std::optional<std::vector<std::string>> layers;
+
     Json::Dict Process(const TransportCatalog& db) const;
   };
 
-  std::variant<Stop, Bus, Route, Map> Read(const Json::Dict& attrs);
+  struct NearestStops {
+    Sphere::Point position;
+    int count;  // as given: negative ones are answered with an error
+    double radius;  // in meters, likewise
+
+    Json::Dict Process(const TransportCatalog& db) const;
+  };
+
+  struct RouterStats {
+    Json::Dict Process(const TransportCatalog& db) const;
+  };
+
+  // Heap memory of every built subsystem, estimated from its containers (see MemoryUsage),
+  // and the peak resident memory of the process
+  struct MemoryStats {
+    Json::Dict Process(TransportCatalog& db) const;
+  };
+
+  // Changes of the network: answered in order, so later requests see them
+  struct UpdateStop {
+    Descriptions::Stop stop;
+
+    Json::Dict Process(TransportCatalog& db) const;
+  };
+
+  struct UpdateBus {
+    Descriptions::Bus bus;
+
+    Json::Dict Process(TransportCatalog& db) const;
+  };
+
+  struct RemoveStop {
+    std::string name;
+
+    Json::Dict Process(TransportCatalog& db) const;
+  };
+
+  struct RemoveBus {
+    std::string name;
+
+    Json::Dict Process(TransportCatalog& db) const;
+  };
+
+  std::variant<Stop, Bus, Route, Map, NearestStops, RouterStats, MemoryStats,
+               UpdateStop, UpdateBus, RemoveStop, RemoveBus> Read(const Json::Dict& attrs);
+
+  std::vector<Json::Node> ProcessAll(TransportCatalog& db, const std::vector<Json::Node>& requests);
+
+  // Starts background builds of the engines the requests will need
+  void PrepareCatalog(const TransportCatalog& db, const std::vector<Json::Node>& requests);
 
-  std::vector<Json::Node> ProcessAll(const TransportCatalog& db, const std::vector<Json::Node>& requests);
+  // Prints the responses array as it goes, so early answers do not wait for later ones.
+  // A request that fails is answered with {"error_message": ...} and the rest are still answered
+  void ProcessAll(TransportCatalog& db, const std::vector<Json::Node>& requests, std::ostream& output);
 }
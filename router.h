@@ -1,18 +1,28 @@
 #pragma once
 
 #include "graph.h"
+#include "graph_serialization.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <functional>
+#include <istream>
 #include <iterator>
 #include <optional>
+#include <ostream>
+#include <queue>
+#include <stdexcept>
 #include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace Graph {
 
+  // Layout of what the engines' Serialize writes, with the graph fingerprint ahead of each;
+  // bump on any change so that artifacts of older builds miss the cache
+  inline constexpr uint32_t FORMAT_VERSION = 3;
+
   template <typename Weight>
   class Router {
   private:
@@ -33,6 +43,17 @@ namespace Graph {
     EdgeId GetRouteEdge(RouteId route_id, size_t edge_idx) const;
     void ReleaseRoute(RouteId route_id);
 
+    MemoryUsage GetMemoryUsage() const;  // of the routes table
+
+    // The graph the router was built for has been replaced in place by a graph over the same vertices.
+    // Rows of the table that a changed edge can affect are recomputed by Dijkstra; the others keep
+    // their routes, renumbering the edges. Returns the number of rows recomputed
+    size_t Update(const Graph& old_graph);
+
+    void Serialize(std::ostream& output) const;
+    // The graph must be the one the router was built for
+    static Router Deserialize(const Graph& graph, std::istream& input);
+
   private:
     const Graph& graph_;
 
@@ -42,6 +63,9 @@ namespace Graph {
     };
     using RoutesInternalData = std::vector<std::vector<std::optional<RouteInternalData>>>;
 
+    Router(const Graph& graph, RoutesInternalData routes_internal_data)
+        : graph_(graph), routes_internal_data_(std::move(routes_internal_data)) {}
+
     using ExpandedRoute = std::vector<EdgeId>;
     mutable RouteId next_route_id_ = 0;
     mutable std::unordered_map<RouteId, ExpandedRoute> expanded_routes_cache_;
@@ -87,6 +111,32 @@ namespace Graph {
       }
     }
 
+    // Row of vertex_from by Dijkstra over the current graph
+    void ComputeRoutesFrom(VertexId vertex_from) {
+      auto& routes = routes_internal_data_[vertex_from];
+      std::fill(std::begin(routes), std::end(routes), std::nullopt);
+      routes[vertex_from] = RouteInternalData{0, std::nullopt};
+      using QueueItem = std::pair<Weight, VertexId>;
+      std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+      queue.push({0, vertex_from});
+      while (!queue.empty()) {
+        const auto [weight, vertex] = queue.top();
+        queue.pop();
+        if (weight > routes[vertex]->weight) {
+          continue;
+        }
+        for (const EdgeId edge_id : graph_.GetIncidentEdges(vertex)) {
+          const auto& edge = graph_.GetEdge(edge_id);
+          const Weight candidate_weight = weight + edge.weight;
+          auto& route = routes[edge.to];
+          if (!route || candidate_weight < route->weight) {
+            route = RouteInternalData{candidate_weight, edge_id};
+            queue.push({candidate_weight, edge.to});
+          }
+        }
+      }
+    }
+
     RoutesInternalData routes_internal_data_;
   };
 
@@ -135,4 +185,118 @@ namespace Graph {
     expanded_routes_cache_.erase(route_id);
   }
 
+  template <typename Weight>
+  MemoryUsage Router<Weight>::GetMemoryUsage() const {
+    return ComputeMemoryUsage(routes_internal_data_);
+  }
+
+  template <typename Weight>
+  size_t Router<Weight>::Update(const Graph& old_graph) {
+    const size_t vertex_count = graph_.GetVertexCount();
+    assert(old_graph.GetVertexCount() == vertex_count);
+
+    // Only the lightest edge between two vertices can be on a route, as in InitializeRoutesInternalData
+    struct ChangedEdge {
+      VertexId from;
+      VertexId to;
+      Weight weight;
+    };
+    std::vector<ChangedEdge> worsened_edges;  // removed or heavier, with the old weight
+    std::vector<ChangedEdge> improved_edges;  // added or lighter, with the new weight
+    std::vector<std::optional<EdgeId>> new_edge_ids(old_graph.GetEdgeCount());  // of the edges kept as they were
+    bool are_edge_ids_kept = true;
+    std::unordered_map<VertexId, EdgeId> old_edge_ids_by_target;
+    std::unordered_map<VertexId, EdgeId> edge_ids_by_target;
+    auto collect_lightest_edges = [](const Graph& graph, VertexId from, std::unordered_map<VertexId, EdgeId>& edge_ids) {
+      edge_ids.clear();
+      for (const EdgeId edge_id : graph.GetIncidentEdges(from)) {
+        const auto& edge = graph.GetEdge(edge_id);
+        const auto [it, inserted] = edge_ids.try_emplace(edge.to, edge_id);
+        if (!inserted && edge.weight < graph.GetEdge(it->second).weight) {
+          it->second = edge_id;
+        }
+      }
+    };
+    for (VertexId from = 0; from < vertex_count; ++from) {
+      collect_lightest_edges(old_graph, from, old_edge_ids_by_target);
+      collect_lightest_edges(graph_, from, edge_ids_by_target);
+      for (const auto& [to, old_edge_id] : old_edge_ids_by_target) {
+        const Weight old_weight = old_graph.GetEdge(old_edge_id).weight;
+        const auto it = edge_ids_by_target.find(to);
+        if (it != edge_ids_by_target.end() && graph_.GetEdge(it->second).weight == old_weight) {
+          new_edge_ids[old_edge_id] = it->second;
+          are_edge_ids_kept = are_edge_ids_kept && it->second == old_edge_id;
+        } else if (it == edge_ids_by_target.end() || graph_.GetEdge(it->second).weight > old_weight) {
+          worsened_edges.push_back({from, to, old_weight});
+        }
+      }
+      for (const auto& [to, edge_id] : edge_ids_by_target) {
+        const Weight weight = graph_.GetEdge(edge_id).weight;
+        const auto it = old_edge_ids_by_target.find(to);
+        if (it == old_edge_ids_by_target.end() || weight < old_graph.GetEdge(it->second).weight) {
+          improved_edges.push_back({from, to, weight});
+        }
+      }
+    }
+
+    // A row keeps its routes if none of them may go through a worsened edge, that is, the edge is not tight,
+    // and no improved edge shortens any of them: then the old distances still satisfy every edge
+    size_t recomputed_row_count = 0;
+    for (VertexId vertex_from = 0; vertex_from < vertex_count; ++vertex_from) {
+      auto& routes = routes_internal_data_[vertex_from];
+      bool is_affected = std::any_of(std::begin(worsened_edges), std::end(worsened_edges), [&routes](const ChangedEdge& edge) {
+        return routes[edge.from] && routes[edge.to]
+            && routes[edge.from]->weight + edge.weight <= routes[edge.to]->weight * (1 + 1e-9);
+      }) || std::any_of(std::begin(improved_edges), std::end(improved_edges), [&routes](const ChangedEdge& edge) {
+        return routes[edge.from] && (!routes[edge.to] || routes[edge.from]->weight + edge.weight < routes[edge.to]->weight);
+      });
+      if (!is_affected && !are_edge_ids_kept) {
+        for (auto& route : routes) {
+          if (!route || !route->prev_edge) {
+            continue;
+          }
+          if (!new_edge_ids[*route->prev_edge]) {
+            is_affected = true;  // a parallel edge of the same weight: rare enough to recompute
+            break;
+          }
+          route->prev_edge = new_edge_ids[*route->prev_edge];
+        }
+      }
+      if (is_affected) {
+        ComputeRoutesFrom(vertex_from);
+        ++recomputed_row_count;
+      }
+    }
+    return recomputed_row_count;
+  }
+
+  // Binary, for the same build only: no endianness conversion; the layout is versioned by FORMAT_VERSION
+  template <typename Weight>
+  void Router<Weight>::Serialize(std::ostream& output) const {
+    for (const auto& row : routes_internal_data_) {
+      Detail::WriteVector(output, row);
+    }
+  }
+
+  template <typename Weight>
+  Router<Weight> Router<Weight>::Deserialize(const Graph& graph, std::istream& input) {
+    RoutesInternalData routes_internal_data(graph.GetVertexCount());
+    for (auto& row : routes_internal_data) {
+      row = Detail::ReadVector<std::optional<RouteInternalData>>(input);
+      if (row.size() != graph.GetVertexCount()) {
+        throw std::runtime_error("Malformed routes table");
+      }
+    }
+    // routes are followed edge by edge back to their start, so the edges must lead to their columns
+    for (const auto& row : routes_internal_data) {
+      for (VertexId vertex_to = 0; vertex_to < row.size(); ++vertex_to) {
+        if (row[vertex_to] && row[vertex_to]->prev_edge
+            && (*row[vertex_to]->prev_edge >= graph.GetEdgeCount() || graph.GetEdge(*row[vertex_to]->prev_edge).to != vertex_to)) {
+          throw std::runtime_error("Malformed routes table");
+        }
+      }
+    }
+    return Router(graph, std::move(routes_internal_data));
+  }
+
 }
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "memory_usage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+struct BoundingBox {
+  double min_x;
+  double min_y;
+  double max_x;
+  double max_y;
+
+  bool IntersectsSegment(double x1, double y1, double x2, double y2) const;
+};
+
+// Liang-Barsky clipping; a point is a degenerate segment
+inline bool BoundingBox::IntersectsSegment(double x1, double y1, double x2, double y2) const {
+  const double dx = x2 - x1;
+  const double dy = y2 - y1;
+  const double p[] = {-dx, dx, -dy, dy};
+  const double q[] = {x1 - min_x, max_x - x1, y1 - min_y, max_y - y1};
+  double t_enter = 0.0;
+  double t_exit = 1.0;
+  for (size_t i = 0; i < 4; ++i) {
+    if (p[i] == 0) {
+      if (q[i] < 0) {
+        return false;
+      }
+    } else {
+      const double t = q[i] / p[i];
+      if (p[i] < 0) {
+        t_enter = std::max(t_enter, t);
+      } else {
+        t_exit = std::min(t_exit, t);
+      }
+    }
+  }
+  return t_enter <= t_exit;
+}
+
+// Uniform grid over points and segments. Items are returned in the order they were added,
+// so callers can keep their drawing order without extra sorting.
+template <typename Item>
+class SpatialGrid {
+public:
+  SpatialGrid(BoundingBox bounds, size_t expected_item_count);
+
+  void AddPoint(Item item, double x, double y);
+  void AddSegment(Item item, double x1, double y1, double x2, double y2);
+
+  std::vector<Item> FindIntersecting(const BoundingBox& box) const;
+
+  MemoryUsage GetMemoryUsage() const {
+    return ComputeMemoryUsage(entries_) + ComputeMemoryUsage(cells_);
+  }
+
+private:
+  struct Entry {
+    Item item;
+    double x1, y1, x2, y2;
+  };
+
+  size_t GetColumn(double x) const;
+  size_t GetRow(double y) const;
+  BoundingBox GetCellBox(size_t column, size_t row) const;
+
+  BoundingBox bounds_;
+  size_t column_count_;
+  size_t row_count_;
+  double cell_width_;
+  double cell_height_;
+  std::vector<Entry> entries_;
+  std::vector<std::vector<uint32_t>> cells_;
+};
+
+
+template <typename Item>
+SpatialGrid<Item>::SpatialGrid(BoundingBox bounds, size_t expected_item_count)
+    : bounds_(bounds)
+{
+  const size_t side = std::clamp<size_t>(static_cast<size_t>(std::sqrt(expected_item_count)), 1, 1024);
+  column_count_ = side;
+  row_count_ = side;
+  const double width = bounds_.max_x - bounds_.min_x;
+  const double height = bounds_.max_y - bounds_.min_y;
+  cell_width_ = width > 0 ? width / column_count_ : 1.0;
+  cell_height_ = height > 0 ? height / row_count_ : 1.0;
+  cells_.resize(column_count_ * row_count_);
+  entries_.reserve(expected_item_count);
+}
+
+template <typename Item>
+size_t SpatialGrid<Item>::GetColumn(double x) const {
+  const double column = std::floor((x - bounds_.min_x) / cell_width_);
+  return static_cast<size_t>(std::clamp(column, 0.0, static_cast<double>(column_count_ - 1)));
+}
+
+template <typename Item>
+size_t SpatialGrid<Item>::GetRow(double y) const {
+  const double row = std::floor((y - bounds_.min_y) / cell_height_);
+  return static_cast<size_t>(std::clamp(row, 0.0, static_cast<double>(row_count_ - 1)));
+}
+
+template <typename Item>
+BoundingBox SpatialGrid<Item>::GetCellBox(size_t column, size_t row) const {
+  // border cells are open to the outside, like GetColumn/GetRow clamp
+  const double min_x = column == 0 ? -INFINITY : bounds_.min_x + column * cell_width_;
+  const double max_x = column + 1 == column_count_ ? INFINITY : bounds_.min_x + (column + 1) * cell_width_;
+  const double min_y = row == 0 ? -INFINITY : bounds_.min_y + row * cell_height_;
+  const double max_y = row + 1 == row_count_ ? INFINITY : bounds_.min_y + (row + 1) * cell_height_;
+  return {min_x, min_y, max_x, max_y};
+}
+
+template <typename Item>
+void SpatialGrid<Item>::AddPoint(Item item, double x, double y) {
+  cells_[GetRow(y) * column_count_ + GetColumn(x)].push_back(entries_.size());
+  entries_.push_back({item, x, y, x, y});
+}
+
+template <typename Item>
+void SpatialGrid<Item>::AddSegment(Item item, double x1, double y1, double x2, double y2) {
+  const uint32_t entry_id = entries_.size();
+  entries_.push_back({item, x1, y1, x2, y2});
+  const size_t min_column = GetColumn(std::min(x1, x2));
+  const size_t max_column = GetColumn(std::max(x1, x2));
+  const size_t min_row = GetRow(std::min(y1, y2));
+  const size_t max_row = GetRow(std::max(y1, y2));
+  for (size_t row = min_row; row <= max_row; ++row) {
+    for (size_t column = min_column; column <= max_column; ++column) {
+      if (GetCellBox(column, row).IntersectsSegment(x1, y1, x2, y2)) {
+        cells_[row * column_count_ + column].push_back(entry_id);
+      }
+    }
+  }
+}
+
+template <typename Item>
+std::vector<Item> SpatialGrid<Item>::FindIntersecting(const BoundingBox& box) const {
+  if (box.min_x > box.max_x || box.min_y > box.max_y) {
+    return {};
+  }
+  std::vector<uint32_t> entry_ids;
+  for (size_t row = GetRow(box.min_y); row <= GetRow(box.max_y); ++row) {
+    for (size_t column = GetColumn(box.min_x); column <= GetColumn(box.max_x); ++column) {
+      const auto& cell = cells_[row * column_count_ + column];
+      entry_ids.insert(std::end(entry_ids), std::begin(cell), std::end(cell));
+    }
+  }
+  std::sort(std::begin(entry_ids), std::end(entry_ids));
+  entry_ids.erase(std::unique(std::begin(entry_ids), std::end(entry_ids)), std::end(entry_ids));
+
+  std::vector<Item> result;
+  for (const uint32_t entry_id : entry_ids) {
+    const Entry& entry = entries_[entry_id];
+    if (box.IntersectsSegment(entry.x1, entry.y1, entry.x2, entry.y2)) {
+      result.push_back(entry.item);
+    }
+  }
+  return result;
+}
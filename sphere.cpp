@@ -1,10 +1,10 @@
 #include "sphere.h"
 
+#include <algorithm>
+
 using namespace std;
 
 namespace Sphere {
-  const double PI = 3.1415926535;
-
   double ConvertDegreesToRadians(double degrees) {
     return degrees * PI / 180.0;
   }
@@ -16,14 +16,13 @@ namespace Sphere {
     };
   }
 
-  const double EARTH_RADIUS = 6'371'000;
-
   double Distance(Point lhs, Point rhs) {
     lhs = Point::FromDegrees(lhs.latitude, lhs.longitude);
     rhs = Point::FromDegrees(rhs.latitude, rhs.longitude);
-    return acos(
+    // rounding may push the cosine slightly above 1 for (nearly) equal points
+    return acos(min(1.0,
       sin(lhs.latitude) * sin(rhs.latitude)
       + cos(lhs.latitude) * cos(rhs.latitude) * cos(abs(lhs.longitude - rhs.longitude))
-    ) * EARTH_RADIUS;
+    )) * EARTH_RADIUS;
   }
 }
@@ -0,0 +1,146 @@
+#include "stops_index.h"
+
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
+using namespace std;
+
+StopsIndex::StopsIndex(const Descriptions::StopsDict& stops_dict) {
+  stop_names_.reserve(stops_dict.size());
+  stop_positions_.reserve(stops_dict.size());
+  nodes_.reserve(stops_dict.size());
+  for (const auto& [stop_name, stop] : stops_dict) {
+    nodes_.push_back({Project(stop->position), 0, stop_names_.size()});
+    stop_names_.push_back(stop_name);
+    stop_positions_.push_back(stop->position);
+  }
+  Build(0, nodes_.size());
+}
+
+StopsIndex::Vector3 StopsIndex::Project(Sphere::Point position) {
+  const double latitude = Sphere::ConvertDegreesToRadians(position.latitude);
+  const double longitude = Sphere::ConvertDegreesToRadians(position.longitude);
+  return {{
+      cos(latitude) * cos(longitude),
+      cos(latitude) * sin(longitude),
+      sin(latitude)
+  }};
+}
+
+double StopsIndex::SquaredChord(const Vector3& lhs, const Vector3& rhs) {
+  double result = 0;
+  for (size_t axis = 0; axis < 3; ++axis) {
+    const double diff = lhs.coords[axis] - rhs.coords[axis];
+    result += diff * diff;
+  }
+  return result;
+}
+
+void StopsIndex::Build(size_t begin, size_t end) {
+  if (end - begin <= 1) {
+    return;
+  }
+
+  // split by the axis with the widest spread
+  uint8_t axis = 0;
+  double widest_spread = -1;
+  for (uint8_t candidate_axis = 0; candidate_axis < 3; ++candidate_axis) {
+    const auto [min_it, max_it] = minmax_element(
+        std::begin(nodes_) + begin, std::begin(nodes_) + end,
+        [candidate_axis](const Node& lhs, const Node& rhs) {
+          return lhs.point.coords[candidate_axis] < rhs.point.coords[candidate_axis];
+        }
+    );
+    const double spread = max_it->point.coords[candidate_axis] - min_it->point.coords[candidate_axis];
+    if (spread > widest_spread) {
+      widest_spread = spread;
+      axis = candidate_axis;
+    }
+  }
+
+  const size_t middle = begin + (end - begin) / 2;
+  nth_element(
+      std::begin(nodes_) + begin, std::begin(nodes_) + middle, std::begin(nodes_) + end,
+      [axis](const Node& lhs, const Node& rhs) {
+        return lhs.point.coords[axis] < rhs.point.coords[axis];
+      }
+  );
+  nodes_[middle].axis = axis;
+
+  Build(begin, middle);
+  Build(middle + 1, end);
+}
+
+struct StopsIndex::Query {
+  Vector3 target;
+  size_t count;
+  double max_squared_chord;
+  vector<Candidate> heap;  // max-heap by squared chord, at most count items
+
+  double GetBound() const {
+    return heap.size() < count ? max_squared_chord : heap.front().squared_chord;
+  }
+
+  void Offer(Candidate candidate) {
+    if (candidate.squared_chord > max_squared_chord) {
+      return;
+    }
+    if (heap.size() < count) {
+      heap.push_back(candidate);
+      push_heap(std::begin(heap), std::end(heap));
+    } else if (candidate < heap.front()) {
+      pop_heap(std::begin(heap), std::end(heap));
+      heap.back() = candidate;
+      push_heap(std::begin(heap), std::end(heap));
+    }
+  }
+};
+
+void StopsIndex::Search(size_t begin, size_t end, Query& query) const {
+  if (begin >= end) {
+    return;
+  }
+  const size_t middle = begin + (end - begin) / 2;
+  const Node& node = nodes_[middle];
+  query.Offer({SquaredChord(query.target, node.point), node.stop_idx});
+  if (end - begin == 1) {
+    return;
+  }
+
+  const double diff = query.target.coords[node.axis] - node.point.coords[node.axis];
+  const auto [near_begin, near_end, far_begin, far_end] = diff < 0
+      ? tuple{begin, middle, middle + 1, end}
+      : tuple{middle + 1, end, begin, middle};
+  Search(near_begin, near_end, query);
+  if (diff * diff <= query.GetBound()) {
+    Search(far_begin, far_end, query);
+  }
+}
+
+vector<StopsIndex::Item> StopsIndex::FindNearest(Sphere::Point position, size_t count, double radius) const {
+  if (count == 0 || nodes_.empty()) {
+    return {};
+  }
+
+  // chord of the unit sphere for the arc of given length, with a margin for rounding errors
+  const double angle = min(radius / Sphere::EARTH_RADIUS, Sphere::PI);
+  const double max_chord = 2 * sin(angle / 2) * (1 + 1e-9) + 1e-12;
+
+  Query query{Project(position), count, max_chord * max_chord, {}};
+  query.heap.reserve(min(count, nodes_.size()));
+  Search(0, nodes_.size(), query);
+
+  vector<Item> result;
+  result.reserve(query.heap.size());
+  for (const Candidate& candidate : query.heap) {
+    const double distance = Sphere::Distance(position, stop_positions_[candidate.stop_idx]);
+    if (distance <= radius) {
+      result.push_back({&stop_names_[candidate.stop_idx], distance});
+    }
+  }
+  sort(std::begin(result), std::end(result), [](const Item& lhs, const Item& rhs) {
+    return tie(lhs.distance, *lhs.stop_name) < tie(rhs.distance, *rhs.stop_name);
+  });
+  return result;
+}
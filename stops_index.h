@@ -0,0 +1,56 @@
+#pragma once
+
+#include "descriptions.h"
+#include "sphere.h"
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+// k-d tree over stop positions projected onto the unit sphere.
+// Euclidean (chord) distance between projected points is monotonic in the
+// great-circle distance, so nearest neighbours in 3D are nearest on the sphere.
+class StopsIndex {
+public:
+  explicit StopsIndex(const Descriptions::StopsDict& stops_dict);
+
+  struct Item {
+    const std::string* stop_name;
+    double distance;  // in meters, by Sphere::Distance
+  };
+
+  std::vector<Item> FindNearest(Sphere::Point position, size_t count,
+                                double radius = std::numeric_limits<double>::infinity()) const;
+
+  size_t GetStopCount() const { return nodes_.size(); }
+
+private:
+  struct Vector3 {
+    double coords[3];
+  };
+
+  static Vector3 Project(Sphere::Point position);
+  static double SquaredChord(const Vector3& lhs, const Vector3& rhs);
+
+  struct Node {
+    Vector3 point;
+    uint8_t axis;
+    size_t stop_idx;
+  };
+
+  void Build(size_t begin, size_t end);
+
+  struct Candidate {
+    double squared_chord;
+    size_t stop_idx;
+    bool operator<(const Candidate& other) const { return squared_chord < other.squared_chord; }
+  };
+  struct Query;
+  void Search(size_t begin, size_t end, Query& query) const;
+
+  // implicit balanced tree: the node of range [begin, end) is stored at its middle
+  std::vector<Node> nodes_;
+  std::vector<std::string> stop_names_;
+  std::vector<Sphere::Point> stop_positions_;
+};
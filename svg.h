@@ -6,9 +6,12 @@
 #include <vector>
 #include <string>
 #include <sstream>
+#include <unordered_map>
 #include <fstream>
 #include <iomanip>
 
+#include "memory_usage.h"
+
 namespace Svg {
 
     struct Point {
@@ -19,6 +22,12 @@ namespace Svg {
         double y;
     };
 
+    // Размер холста документа: без него просмотрщики берут размер по умолчанию
+    struct Size {
+        double width;
+        double height;
+    };
+
     struct Rgb {
         Rgb() : red(0), green(0), blue(0) {}
         Rgb(uint8_t r, uint8_t g, uint8_t b) : red(r), green(g), blue(b) {}
@@ -67,12 +76,56 @@ namespace Svg {
             }
             return o;
         }
+        bool HasAlpha() const {
+            return std::holds_alternative<Rgba>(color_);
+        }
+        MemoryUsage GetMemoryUsage() const {
+            return ComputeMemoryUsage(color_);
+        }
     private:
         std::variant<std::monostate, std::string, Rgb, Rgba> color_;
     };
 
     const Color NoneColor{};
 
+    // Повторяющиеся наборы атрибутов оформления, вынесенные в CSS-классы
+    class StyleSheet {
+    public:
+        const std::string& AddStyle(const std::string& style) {
+            auto [it, inserted] = class_names_.try_emplace(style);
+            if (inserted) {
+                it->second = "s" + std::to_string(styles_.size());
+                styles_.push_back({ it->second, style });
+            }
+            return it->second;
+        }
+        // Только поиск: отрисовка по готовой таблице может идти из нескольких потоков
+        const std::string& GetClass(const std::string& style) const {
+            return class_names_.at(style);
+        }
+        void Merge(const StyleSheet& other) {
+            for (const auto& [_, style] : other.styles_) {
+                AddStyle(style);
+            }
+        }
+        void Render(std::ostream& o) const {
+            if (styles_.empty()) {
+                return;
+            }
+            o << "<style>";
+            for (const auto& [class_name, style] : styles_) {
+                o << "." << class_name << "{" << style << "}";
+            }
+            o << "</style>";
+        }
+        MemoryUsage GetMemoryUsage() const {
+            return ComputeMemoryUsage(class_names_) + ComputeMemoryUsage(styles_);
+        }
+    private:
+        std::unordered_map<std::string, std::string> class_names_;
+        std::vector<std::pair<std::string, std::string>> styles_;  // (class, style) in order of appearance
+    };
+
     template <class T>
     class Figure {
     public:
@@ -97,6 +150,21 @@ namespace Svg {
             stroke_linejoin_ = s;
             return *(static_cast<T*>(this));
         }
+        T& SetFillOpacity(double opacity) {
+            fill_opacity_ = opacity;
+            return *(static_cast<T*>(this));
+        }
+        std::string GetStyle() const {
+            std::ostringstream style;
+            style << std::setprecision(10);
+            static_cast<const T*>(this)->RenderStyle(style);
+            return style.str();
+        }
+        // Память, занятая оформлением; наследники добавляют свои данные
+        MemoryUsage GetMemoryUsage() const {
+            return fill_color_.GetMemoryUsage() + stroke_color_.GetMemoryUsage()
+                + ComputeMemoryUsage(stroke_linecap_) + ComputeMemoryUsage(stroke_linejoin_);
+        }
         friend std::ostream& operator<<(std::ostream& o, const Figure& f) {
             o << "fill=\"" << f.fill_color_ << "\" stroke=\"" << f.stroke_color_
                 << "\" stroke-width=\"" << f.line_width_ << "\" ";
@@ -107,17 +175,47 @@ namespace Svg {
             if (!f.stroke_linejoin_.empty()) {
                 o << "stroke-linejoin=\"" << f.stroke_linejoin_ << "\" ";
             }
+            if (f.fill_opacity_) {
+                o << "fill-opacity=\"" << *f.fill_opacity_ << "\" ";
+            }
             return o;
         }
     protected:
+        // То же оформление, что и в атрибутах, но в виде CSS-объявлений
+        void RenderStyle(std::ostream& o) const {
+            o << "fill:" << fill_color_ << ";stroke:" << stroke_color_
+                << ";stroke-width:" << line_width_ << "px;";
+            if (!stroke_linecap_.empty()) {
+                o << "stroke-linecap:" << stroke_linecap_ << ";";
+            }
+            if (!stroke_linejoin_.empty()) {
+                o << "stroke-linejoin:" << stroke_linejoin_ << ";";
+            }
+            if (fill_opacity_) {
+                o << "fill-opacity:" << *fill_opacity_ << ";";
+            }
+        }
+        void RenderPresentation(std::ostream& o, const StyleSheet* styles) const {
+            if (styles) {
+                o << "class=\"" << styles->GetClass(GetStyle()) << "\" ";
+            } else {
+                static_cast<const T*>(this)->RenderPresentationAttributes(o);
+            }
+        }
+        void RenderPresentationAttributes(std::ostream& o) const {
+            o << static_cast<const Figure&>(*this);
+        }
+
         Color fill_color_;
         Color stroke_color_;
         double line_width_;
         std::string stroke_linecap_;
         std::string stroke_linejoin_;
+        std::optional<double> fill_opacity_;  // без значения атрибут не выводится
     };
 
     class Circle : public Figure<Circle> {
+        friend class Figure<Circle>;
     public:
         Circle() : radius_(1.0) {}
         Circle& SetCenter(Point p) {
@@ -128,11 +226,14 @@ namespace Svg {
             radius_ = r;
             return *this;
         }
-        friend std::ostream& operator<<(std::ostream& o, const Circle& c) {
+        void Render(std::ostream& o, const StyleSheet* styles = nullptr) const {
             o << "<circle ";
-            o << "cx=\"" << c.center_.x << "\" cy=\"" << c.center_.y << "\" r=\"" << c.radius_ << "\" ";
-            o << (Figure)c;
+            o << "cx=\"" << center_.x << "\" cy=\"" << center_.y << "\" r=\"" << radius_ << "\" ";
+            RenderPresentation(o, styles);
             o << "/>";
+        }
+        friend std::ostream& operator<<(std::ostream& o, const Circle& c) {
+            c.Render(o);
             return o;
         }
     private:
@@ -140,27 +241,100 @@ namespace Svg {
         double radius_;
     };
 
+    class Rect : public Figure<Rect> {
+        friend class Figure<Rect>;
+    public:
+        Rect() : width_(0.0), height_(0.0) {}
+        Rect& SetPoint(Point p) {
+            corner_ = p;
+            return *this;
+        }
+        Rect& SetWidth(double w) {
+            width_ = w;
+            return *this;
+        }
+        Rect& SetHeight(double h) {
+            height_ = h;
+            return *this;
+        }
+        void Render(std::ostream& o, const StyleSheet* styles = nullptr) const {
+            o << "<rect ";
+            o << "x=\"" << corner_.x << "\" y=\"" << corner_.y << "\" ";
+            o << "width=\"" << width_ << "\" height=\"" << height_ << "\" ";
+            RenderPresentation(o, styles);
+            o << "/>";
+        }
+        friend std::ostream& operator<<(std::ostream& o, const Rect& r) {
+            r.Render(o);
+            return o;
+        }
+    private:
+        Point corner_;
+        double width_;
+        double height_;
+    };
+
     class Polyline : public Figure<Polyline> {
+        friend class Figure<Polyline>;
     public:
         Polyline& AddPoint(Point p) {
             coord_.push_back(p);
             return *this;
         }
-        friend std::ostream& operator<<(std::ostream& o, const Polyline& p) {
+        void Render(std::ostream& o, const StyleSheet* styles = nullptr) const {
             o << "<polyline points=\"";
-            for (const auto& c : p.coord_) {
+            for (const auto& c : coord_) {
                 o << c.x << "," << c.y << " ";
             }
             o << "\" ";
-            o << (Figure)p;
+            RenderPresentation(o, styles);
             o << "/>";
+        }
+        friend std::ostream& operator<<(std::ostream& o, const Polyline& p) {
+            p.Render(o);
+            return o;
+        }
+        MemoryUsage GetMemoryUsage() const {
+            return Figure::GetMemoryUsage() + ComputeMemoryUsage(coord_);
+        }
+    private:
+        std::vector<Point> coord_;
+    };
+
+    // Та же ломаная, но в виде пути с относительными координатами: короче в записи
+    class Path : public Figure<Path> {
+        friend class Figure<Path>;
+    public:
+        Path& AddPoint(Point p) {
+            coord_.push_back(p);
+            return *this;
+        }
+        void Render(std::ostream& o, const StyleSheet* styles = nullptr) const {
+            o << "<path d=\"";
+            for (size_t i = 0; i < coord_.size(); ++i) {
+                if (i == 0) {
+                    o << "M" << coord_[i].x << "," << coord_[i].y;
+                } else {
+                    o << (i == 1 ? "l" : " ") << coord_[i].x - coord_[i - 1].x << "," << coord_[i].y - coord_[i - 1].y;
+                }
+            }
+            o << "\" ";
+            RenderPresentation(o, styles);
+            o << "/>";
+        }
+        friend std::ostream& operator<<(std::ostream& o, const Path& p) {
+            p.Render(o);
             return o;
         }
+        MemoryUsage GetMemoryUsage() const {
+            return Figure::GetMemoryUsage() + ComputeMemoryUsage(coord_);
+        }
     private:
         std::vector<Point> coord_;
     };
 
     class Text : public Figure<Text> {
+        friend class Figure<Text>;
     public:
         Text() : size_(1) {}
         Text& SetPoint(Point p) {
@@ -187,25 +361,46 @@ namespace Svg {
             data_ = s;
             return *this;
         }
-        friend std::ostream& operator<<(std::ostream& o, const Text& t) {
+        void Render(std::ostream& o, const StyleSheet* styles = nullptr) const {
             o << "<text ";
-            o << "x=\"" << t.coord_.x << "\" y=\"" << t.coord_.y << "\" ";
-            o << "dx=\"" << t.offset_.x << "\" dy=\"" << t.offset_.y << "\" ";
-            o << "font-size=\"" << t.size_ << "\" ";
-            if (!t.family_.empty()) {
-                o << "font-family=\"" << t.family_ << "\" ";
-            }           
-            if (!t.weight_.empty()) {
-                o << "font-weight=\"" << t.weight_ << "\" ";
-            }
-            o << (Figure)t;
+            o << "x=\"" << coord_.x << "\" y=\"" << coord_.y << "\" ";
+            o << "dx=\"" << offset_.x << "\" dy=\"" << offset_.y << "\" ";
+            RenderPresentation(o, styles);
             o << ">";
-            o << t.data_;
+            o << data_;
             o << "</text>";
-
+        }
+        friend std::ostream& operator<<(std::ostream& o, const Text& t) {
+            t.Render(o);
             return o;
         }
+        MemoryUsage GetMemoryUsage() const {
+            return Figure::GetMemoryUsage()
+                + ComputeMemoryUsage(family_) + ComputeMemoryUsage(data_) + ComputeMemoryUsage(weight_);
+        }
     private:
+        // шрифт - тоже часть оформления
+        void RenderPresentationAttributes(std::ostream& o) const {
+            o << "font-size=\"" << size_ << "\" ";
+            if (!family_.empty()) {
+                o << "font-family=\"" << family_ << "\" ";
+            }           
+            if (!weight_.empty()) {
+                o << "font-weight=\"" << weight_ << "\" ";
+            }
+            Figure::RenderPresentationAttributes(o);
+        }
+        void RenderStyle(std::ostream& o) const {
+            o << "font-size:" << size_ << "px;";
+            if (!family_.empty()) {
+                o << "font-family:" << family_ << ";";
+            }
+            if (!weight_.empty()) {
+                o << "font-weight:" << weight_ << ";";
+            }
+            Figure::RenderStyle(o);
+        }
+
         Point coord_;
         Point offset_;
         uint32_t size_;
@@ -216,20 +411,61 @@ namespace Svg {
 
     class Document {
     public:
-        void Add(std::variant<Circle, Polyline, Text> obj) {
+        void Add(std::variant<Circle, Polyline, Text, Rect, Path> obj) {
             objects_.push_back(obj);
         }
-        void Render(std::ostream& o) {
-            o << R"(<?xml version="1.0" encoding="UTF-8" ?>)";
-            o << R"(<svg xmlns="http://www.w3.org/2000/svg" version="1.1">)";
+        // Размер попадает в корень <svg> как width/height/viewBox
+        void SetSize(Size size) {
+            size_ = size;
+        }
+        // В режиме CSS-классов оформление каждого элемента заменяется ссылкой на класс в блоке <style>
+        void Render(std::ostream& o, bool use_css_classes = false) const {
+            RenderHeader(o, size_);
+            if (use_css_classes) {
+                StyleSheet styles;
+                CollectStyles(styles);
+                styles.Render(o);
+                RenderObjects(o, &styles);
+            } else {
+                RenderObjects(o);
+            }
+            RenderFooter(o);
+        }
+        void CollectStyles(StyleSheet& styles) const {
+            for (const auto& obj : objects_) {
+                visit([&styles](auto&& arg) { styles.AddStyle(arg.GetStyle()); }, obj);
+            }
+        }
+        // Объекты без обрамления: так документ можно собирать из заранее отрисованных частей.
+        // Стили всех объектов должны быть заранее собраны в styles
+        void RenderObjects(std::ostream& o, const StyleSheet* styles = nullptr) const {
             o << std::setprecision(10);
             for (const auto& obj : objects_) {
-                visit([&o](auto&& arg) {o << arg; }, obj);
+                visit([&o, styles](auto&& arg) { arg.Render(o, styles); }, obj);
+            }
+        }
+        static void RenderHeader(std::ostream& o, std::optional<Size> size = std::nullopt) {
+            o << R"(<?xml version="1.0" encoding="UTF-8" ?>)";
+            if (!size) {
+                o << R"(<svg xmlns="http://www.w3.org/2000/svg" version="1.1">)";
+                return;
             }
+            o << std::setprecision(10);
+            o << R"(<svg xmlns="http://www.w3.org/2000/svg" version="1.1" width=")" << size->width
+              << R"(" height=")" << size->height << R"(" viewBox="0 0 )" << size->width << ' ' << size->height << R"(">)";
+        }
+        static void RenderFooter(std::ostream& o) {
             o << R"(</svg>)";
-
+        }
+        MemoryUsage GetMemoryUsage() const {
+            MemoryUsage result = ComputeArrayUsage<std::variant<Circle, Polyline, Text, Rect, Path>>(objects_.capacity());
+            for (const auto& obj : objects_) {
+                result += visit([](auto&& arg) { return arg.GetMemoryUsage(); }, obj);
+            }
+            return result;
         }
     private:
-        std::vector<std::variant<Circle, Polyline, Text>> objects_;
+        std::vector<std::variant<Circle, Polyline, Text, Rect, Path>> objects_;
+        std::optional<Size> size_;
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,122 @@
+#include "timetable_router.h"
+
+#include <algorithm>
+#include <limits>
+#include <tuple>
+
+using namespace std;
+
+TimetableRouter::TimetableRouter(const Descriptions::StopsDict& stops_dict,
+                                 const Descriptions::BusesDict& buses_dict,
+                                 const Json::Dict& routing_settings_json) {
+  const double bus_velocity = routing_settings_json.at("bus_velocity").AsDouble();
+  stop_names_.reserve(stops_dict.size());
+  for (const auto& [stop_name, _] : stops_dict) {
+    stop_ids_[stop_name] = stop_names_.size();
+    stop_names_.push_back(stop_name);
+  }
+
+  for (const auto& [bus_name, bus] : buses_dict) {
+    const auto route = bus->GetRoute();
+    if (route.size() <= 1) {
+      continue;
+    }
+    // minutes from the trip start to each stop
+    vector<double> stop_offsets = {0};
+    for (size_t stop_idx = 0; stop_idx + 1 < route.size(); ++stop_idx) {
+      const int distance = Descriptions::ComputeStopsDistance(*stops_dict.at(route[stop_idx]),
+                                                              *stops_dict.at(route[stop_idx + 1]));
+      stop_offsets.push_back(stop_offsets.back() + distance / (bus_velocity * 1000.0 / 60));  // m / (km/h * 1000 / 60) = min
+    }
+    for (const double departure : bus->departures) {
+      const TripId trip = trip_bus_names_.size();
+      trip_bus_names_.push_back(&bus_name);
+      for (size_t stop_idx = 0; stop_idx + 1 < route.size(); ++stop_idx) {
+        connections_.push_back({
+            .departure_time = departure + stop_offsets[stop_idx],
+            .arrival_time = departure + stop_offsets[stop_idx + 1],
+            .departure_stop = stop_ids_.at(route[stop_idx]),
+            .arrival_stop = stop_ids_.at(route[stop_idx + 1]),
+            .trip = trip,
+            .stop_idx = static_cast<uint32_t>(stop_idx),
+        });
+      }
+    }
+  }
+  // stable: instant rides of a trip stay in the order of its stops
+  stable_sort(begin(connections_), end(connections_), [](const Connection& lhs, const Connection& rhs) {
+    return tie(lhs.departure_time, lhs.arrival_time) < tie(rhs.departure_time, rhs.arrival_time);
+  });
+
+  earliest_arrivals_.resize(stop_names_.size());
+  arrival_legs_.resize(stop_names_.size());
+  trip_boardings_.resize(trip_bus_names_.size());
+}
+
+optional<TransportRouter::RouteInfo> TimetableRouter::FindRoute(const string& stop_from, const string& stop_to,
+                                                                double departure_time) const {
+  const auto from_it = stop_ids_.find(stop_from);
+  const auto to_it = stop_ids_.find(stop_to);
+  if (from_it == stop_ids_.end() || to_it == stop_ids_.end()) {
+    return nullopt;  // a stop removed by an update
+  }
+  const StopId from = from_it->second;
+  const StopId to = to_it->second;
+  fill(begin(earliest_arrivals_), end(earliest_arrivals_), numeric_limits<double>::infinity());
+  fill(begin(arrival_legs_), end(arrival_legs_), Leg{});
+  fill(begin(trip_boardings_), end(trip_boardings_), NO_CONNECTION);
+  earliest_arrivals_[from] = departure_time;
+
+  const auto first_connection = lower_bound(begin(connections_), end(connections_), departure_time,
+                                            [](const Connection& connection, double time) {
+                                              return connection.departure_time < time;
+                                            });
+  for (auto it = first_connection; it != end(connections_) && it->departure_time < earliest_arrivals_[to]; ++it) {
+    const Connection& connection = *it;
+    const ConnectionId connection_id = it - begin(connections_);
+    ConnectionId& boarding = trip_boardings_[connection.trip];
+    if (boarding == NO_CONNECTION) {
+      if (earliest_arrivals_[connection.departure_stop] > connection.departure_time) {
+        continue;
+      }
+      boarding = connection_id;
+    }
+    if (connection.arrival_time < earliest_arrivals_[connection.arrival_stop]) {
+      earliest_arrivals_[connection.arrival_stop] = connection.arrival_time;
+      arrival_legs_[connection.arrival_stop] = {boarding, connection_id};
+    }
+  }
+
+  if (earliest_arrivals_[to] == numeric_limits<double>::infinity()) {
+    return nullopt;
+  }
+
+  // legs from the destination back to the origin, each preceded by the wait for its bus
+  vector<TransportRouter::RouteInfo::Item> items;
+  for (StopId stop = to; stop != from; ) {
+    const Leg& leg = arrival_legs_[stop];
+    const Connection& first = connections_[leg.first_connection];
+    const Connection& last = connections_[leg.last_connection];
+    items.push_back(TransportRouter::RouteInfo::BusItem{
+        .bus_name = *trip_bus_names_[first.trip],
+        .time = last.arrival_time - first.departure_time,
+        .span_count = last.stop_idx - first.stop_idx + 1,
+        .start_stop_idx = first.stop_idx,
+        .departure_time = first.departure_time,
+        .arrival_time = last.arrival_time,
+    });
+    stop = first.departure_stop;
+    items.push_back(TransportRouter::RouteInfo::WaitItem{
+        .stop_name = stop_names_[stop],
+        .time = first.departure_time - earliest_arrivals_[stop],
+        .arrival_time = earliest_arrivals_[stop],
+        .departure_time = first.departure_time,
+    });
+  }
+  reverse(begin(items), end(items));
+
+  return TransportRouter::RouteInfo{
+      .total_time = earliest_arrivals_[to] - departure_time,
+      .items = move(items),
+  };
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "descriptions.h"
+#include "json.h"
+#include "transport_router.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Earliest arrival routes over bus timetables by the Connection Scan Algorithm.
+// Every trip of a bus with departures is split into connections between consecutive stops,
+// and a query is a single forward scan over them in the order of departure.
+// Buses without a timetable are not used; rides take road distance / bus_velocity.
+class TimetableRouter {
+public:
+  TimetableRouter(const Descriptions::StopsDict& stops_dict,
+                  const Descriptions::BusesDict& buses_dict,
+                  const Json::Dict& routing_settings_json);
+
+  // departure_time and the timestamps of the items are in minutes since midnight
+  std::optional<TransportRouter::RouteInfo> FindRoute(const std::string& stop_from, const std::string& stop_to,
+                                                      double departure_time) const;
+
+  size_t GetConnectionCount() const { return connections_.size(); }
+
+private:
+  using StopId = uint32_t;
+  using TripId = uint32_t;
+  using ConnectionId = uint32_t;
+  static constexpr ConnectionId NO_CONNECTION = UINT32_MAX;
+
+  struct Connection {
+    double departure_time;
+    double arrival_time;
+    StopId departure_stop;
+    StopId arrival_stop;
+    TripId trip;
+    uint32_t stop_idx;  // of the departure stop in the bus route
+  };
+
+  // Ride on one trip: boarded on the first connection, left after the last one
+  struct Leg {
+    ConnectionId first_connection = NO_CONNECTION;
+    ConnectionId last_connection = NO_CONNECTION;
+  };
+
+  std::vector<std::string> stop_names_;
+  std::unordered_map<std::string, StopId> stop_ids_;
+  std::vector<const std::string*> trip_bus_names_;
+  std::vector<Connection> connections_;  // by departure time
+
+  // scan state, reset by every query
+  mutable std::vector<double> earliest_arrivals_;  // by stop
+  mutable std::vector<Leg> arrival_legs_;  // the leg of the earliest arrival, by stop
+  mutable std::vector<ConnectionId> trip_boardings_;  // by trip
+};
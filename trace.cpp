@@ -0,0 +1,108 @@
+#ifdef TRANSPORT_TRACE
+
+#include "trace.h"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace Trace {
+
+  namespace {
+    struct Event {
+      string name;
+      long long start_us;  // since Start
+      long long duration_us;
+      int thread_id;
+    };
+
+    atomic<bool> is_enabled = false;
+    string output_path;
+    chrono::steady_clock::time_point start_time;
+    mutex events_mutex;
+    vector<Event> events;
+
+    // Small sequential ids instead of std::thread::id, in the order threads record their first span
+    int GetThreadId() {
+      static atomic<int> next_thread_id = 1;
+      thread_local const int thread_id = next_thread_id++;
+      return thread_id;
+    }
+
+    long long ToMicroseconds(chrono::steady_clock::duration duration) {
+      return chrono::duration_cast<chrono::microseconds>(duration).count();
+    }
+
+    void PrintEscaped(const string& value, ostream& output) {
+      output << '"';
+      for (const char symbol : value) {
+        if (symbol == '"' || symbol == '\\') {
+          output << '\\';
+        }
+        output << symbol;
+      }
+      output << '"';
+    }
+  }
+
+  void Start(string path) {
+    output_path = move(path);
+    start_time = chrono::steady_clock::now();
+    GetThreadId();  // the caller, normally the main thread, gets id 1
+    is_enabled = true;
+  }
+
+  void Finish() {
+    if (!is_enabled) {
+      return;
+    }
+    is_enabled = false;
+    ofstream output(output_path);
+    if (!output) {
+      throw runtime_error("Failed to open " + output_path);
+    }
+    lock_guard guard(events_mutex);
+    output << "{\"traceEvents\": [";
+    bool first = true;
+    for (const Event& event : events) {
+      if (!first) {
+        output << ",";
+      }
+      first = false;
+      output << "\n{\"name\": ";
+      PrintEscaped(event.name, output);
+      output << ", \"ph\": \"X\", \"ts\": " << event.start_us << ", \"dur\": " << event.duration_us
+             << ", \"pid\": 1, \"tid\": " << event.thread_id << "}";
+    }
+    output << "\n], \"displayTimeUnit\": \"ms\"}\n";
+  }
+
+  bool IsEnabled() {
+    return is_enabled;
+  }
+
+  Span::Span(string name) : name_(move(name)), start_(chrono::steady_clock::now()) {}
+
+  Span::~Span() {
+    if (!is_enabled) {
+      return;
+    }
+    const auto finish = chrono::steady_clock::now();
+    Event event = {
+        .name = move(name_),
+        .start_us = ToMicroseconds(start_ - start_time),
+        .duration_us = ToMicroseconds(finish - start_),
+        .thread_id = GetThreadId(),
+    };
+    lock_guard guard(events_mutex);
+    events.push_back(move(event));
+  }
+
+}
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+// Spans of startup and request processing in the Chrome trace event format,
+// for chrome://tracing or ui.perfetto.dev. Compiled in only with -DTRANSPORT_TRACE;
+// then recorded once Trace::Start is called, by main for --trace=FILE or TRANSPORT_TRACE_FILE.
+// Without the macro TRACE_SCOPE expands to nothing.
+#ifdef TRANSPORT_TRACE
+
+#include <chrono>
+#include <string>
+
+namespace Trace {
+  void Start(std::string path);
+  // Writes the spans recorded so far to the file given to Start
+  void Finish();
+  bool IsEnabled();
+
+  // Records a complete event from construction to destruction on the calling thread
+  class Span {
+  public:
+    explicit Span(std::string name);
+    ~Span();
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+  private:
+    std::string name_;
+    std::chrono::steady_clock::time_point start_;
+  };
+}
+
+#define TRACE_CONCAT_IMPL(lhs, rhs) lhs##rhs
+#define TRACE_CONCAT(lhs, rhs) TRACE_CONCAT_IMPL(lhs, rhs)
+#define TRACE_SCOPE(name) Trace::Span TRACE_CONCAT(trace_span_, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+
+#endif
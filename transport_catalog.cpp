@@ -1,61 +1,405 @@
 #include "transport_catalog.h"
+#include "trace.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iterator>
 #include <sstream>
+#include <unordered_set>
 
 using namespace std;
 
+namespace Responses {
+  Json::Dict ToJson(const Stop& stop) {
+    vector<Json::Node> bus_nodes;
+    bus_nodes.reserve(stop.bus_names.size());
+    for (const string_view bus_name : stop.bus_names) {
+      bus_nodes.emplace_back(string(bus_name));
+    }
+    return Json::Dict{
+        {"buses", Json::Node(move(bus_nodes))},
+    };
+  }
+
+  Json::Dict ToJson(const Bus& bus) {
+    return Json::Dict{
+        {"stop_count", Json::Node(static_cast<int>(bus.stop_count))},
+        {"unique_stop_count", Json::Node(static_cast<int>(bus.unique_stop_count))},
+        {"route_length", Json::Node(bus.road_route_length)},
+        {"curvature", Json::Node(bus.road_route_length / bus.geo_route_length)},
+    };
+  }
+}
+
+namespace {
+  void InsertSorted(vector<string_view>& items, string_view item) {
+    if (auto it = lower_bound(begin(items), end(items), item); it == end(items) || *it != item) {
+      items.insert(it, item);
+    }
+  }
+
+  void EraseSorted(vector<string_view>& items, string_view item) {
+    if (auto it = lower_bound(begin(items), end(items), item); it != end(items) && *it == item) {
+      items.erase(it);
+    }
+  }
+
+  uint64_t ComputeTextHash(string_view text) {
+    uint64_t hash = 14695981039346656037ull;  // FNV-1a
+    for (const char c : text) {
+      hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+    }
+    return hash;
+  }
+
+  // The map artifact is the map behind a header line "<format version> <size> <hash>",
+  // so that one of another format or a damaged one is drawn anew instead of answered
+  string PackMapArtifact(const string& map) {
+    ostringstream output;
+    output << TransportMap::FORMAT_VERSION << ' ' << map.size() << ' ' << ComputeTextHash(map) << '\n' << map;
+    return output.str();
+  }
+
+  optional<string> UnpackMapArtifact(string artifact) {
+    const size_t header_end = artifact.find('\n');
+    if (header_end == string::npos) {
+      return nullopt;
+    }
+    istringstream header(artifact.substr(0, header_end));
+    uint32_t format_version = 0;
+    size_t size = 0;
+    uint64_t hash = 0;
+    header >> format_version >> size >> hash;
+    artifact.erase(0, header_end + 1);
+    if (!header || format_version != TransportMap::FORMAT_VERSION
+        || artifact.size() != size || ComputeTextHash(artifact) != hash) {
+      return nullopt;
+    }
+    return artifact;
+  }
+}
+
 TransportCatalog::TransportCatalog(vector<Descriptions::InputQuery> data, 
                                     const Json::Dict& routing_settings_json,
-                                    const Json::Dict& render_settings_json) {
+                                    const Json::Dict& render_settings_json,
+                                    Artifacts artifacts)
+    : data_(make_move_iterator(begin(data)), make_move_iterator(end(data))),
+      routing_settings_json_(routing_settings_json),
+      render_settings_json_(render_settings_json),
+      artifacts_(move(artifacts)),
+      stops_index_([this] {
+        return make_unique<StopsIndex>(stops_dict_);
+      }),
+      router_([this] {
+        TRACE_SCOPE("TransportRouter");
+        if (artifacts_.router) {
+          istringstream engines_input(*artifacts_.router);
+          try {
+            return make_unique<TransportRouter>(stops_dict_, buses_dict_, routing_settings_json_, engines_input);
+          } catch (const exception&) {
+            artifacts_.router.reset();  // stale or damaged, built anew
+          }
+        }
+        return make_unique<TransportRouter>(stops_dict_, buses_dict_, routing_settings_json_);
+      }),
+      timetable_router_([this] {
+        return make_unique<TimetableRouter>(stops_dict_, buses_dict_, routing_settings_json_);
+      }),
+      map_([this] {
+        TRACE_SCOPE("TransportMap");
+        return make_unique<TransportMap>(stops_dict_, buses_dict_, render_settings_json_);
+      }) {
+  TRACE_SCOPE("TransportCatalog");
+  if (artifacts_.map) {
+    artifacts_.map = UnpackMapArtifact(move(*artifacts_.map));
+  }
   
-   auto stops_end = partition(begin(data), end(data), [](const auto& item) {
+   auto stops_end = partition(begin(data_), end(data_), [](const auto& item) {
     return holds_alternative<Descriptions::Stop>(item);
   });
 
-  Descriptions::StopsDict stops_dict;
-  double min_lon = 0.0, max_lon = 0.0, min_lat = 0.0, max_lat = 0.0;
-  for (const auto& item : Range{begin(data), stops_end}) {
+  for (const auto& item : Range{begin(data_), stops_end}) {
     const auto& stop = get<Descriptions::Stop>(item);
-    stops_dict[stop.name] = &stop;
+    stops_dict_[stop.name] = &stop;
     stops_.insert({stop.name, {}});
   }
 
-  Descriptions::BusesDict buses_dict;
-  for (const auto& item : Range{stops_end, end(data)}) {
+  for (const auto& item : Range{stops_end, end(data_)}) {
     const auto& bus = get<Descriptions::Bus>(item);
 
-    buses_dict[bus.name] = &bus;
-    buses_[bus.name] = Bus{
-      bus.stops.size(),
-      ComputeUniqueItemsCount(AsRange(bus.stops)),
-      ComputeRoadRouteLength(bus.stops, stops_dict),
-      ComputeGeoRouteDistance(bus.stops, stops_dict)
-    };
+    buses_dict_[bus.name] = &bus;
+    buses_[bus.name].response = ComputeBusStats(bus);
 
     for (const string& stop_name : bus.stops) {
-      stops_.at(stop_name).bus_names.insert(bus.name);
+      stops_.at(stop_name).response.bus_names.push_back(bus.name);
     }
   }
-  
-  router_ = make_unique<TransportRouter>(stops_dict, buses_dict, routing_settings_json);
-  map_ = make_unique<TransportMap>(stops_dict, buses_dict, render_settings_json);
 
+  for (auto& [_, stop_entry] : stops_) {
+    auto& bus_names = stop_entry.response.bus_names;
+    sort(begin(bus_names), end(bus_names));
+    bus_names.erase(unique(begin(bus_names), end(bus_names)), end(bus_names));
+    PrepareResponse(stop_entry);
+  }
+  for (auto& [_, bus_entry] : buses_) {
+    PrepareResponse(bus_entry);
+  }
+}
+
+template <typename Response>
+void TransportCatalog::PrepareResponse(Entry<Response>& entry) {
+  const auto [before_request_id, after_request_id] = Json::PrintAroundKey(Responses::ToJson(entry.response), "request_id");
+  prepared_responses_live_size_ -= entry.prepared.end - entry.prepared.begin;
+  entry.prepared.begin = prepared_responses_.size();
+  prepared_responses_ += before_request_id;
+  entry.prepared.request_id_pos = prepared_responses_.size();
+  prepared_responses_ += after_request_id;
+  entry.prepared.end = prepared_responses_.size();
+  prepared_responses_live_size_ += entry.prepared.end - entry.prepared.begin;
+  if (prepared_responses_.size() > 2 * prepared_responses_live_size_) {
+    CompactPreparedResponses();
+  }
+}
+
+void TransportCatalog::CompactPreparedResponses() {
+  string compacted;
+  compacted.reserve(prepared_responses_live_size_);
+  auto move_prepared = [this, &compacted](PreparedSpan& span) {
+    const size_t begin = compacted.size();
+    compacted.append(prepared_responses_, span.begin, span.end - span.begin);
+    span = {begin, begin + (span.request_id_pos - span.begin), compacted.size()};
+  };
+  for (auto& [_, stop_entry] : stops_) {
+    move_prepared(stop_entry.prepared);
+  }
+  for (auto& [_, bus_entry] : buses_) {
+    move_prepared(bus_entry.prepared);
+  }
+  prepared_responses_ = move(compacted);
+}
+
+void TransportCatalog::PrepareStopResponses(const vector<string>& stop_names) {
+  for (const string& stop_name : unordered_set<string>(begin(stop_names), end(stop_names))) {
+    PrepareResponse(stops_.at(stop_name));
+  }
+}
+
+template <typename Response>
+optional<TransportCatalog::PreparedResponse> TransportCatalog::GetPreparedResponse(
+    const unordered_map<string, Entry<Response>>& entries, const string& name) const {
+  const auto it = entries.find(name);
+  if (it == entries.end()) {
+    return nullopt;
+  }
+  const PreparedSpan& span = it->second.prepared;
+  const string_view prepared_responses = prepared_responses_;
+  return PreparedResponse{
+      prepared_responses.substr(span.begin, span.request_id_pos - span.begin),
+      prepared_responses.substr(span.request_id_pos, span.end - span.request_id_pos),
+  };
+}
+
+TransportCatalog::Bus TransportCatalog::ComputeBusStats(const Descriptions::Bus& bus) const {
+  return Bus{
+    bus.GetRoute().size(),
+    ComputeUniqueItemsCount(AsRange(bus.stops)),
+    ComputeRoadRouteLength(bus.GetRoute(), stops_dict_),
+    ComputeGeoRouteDistance(bus.GetRoute(), stops_dict_)
+  };
+}
+
+TransportCatalog::Artifacts TransportCatalog::GetArtifacts() {
+  Artifacts artifacts;
+  if (is_updated_) {
+    return artifacts;
+  }
+  const TransportRouter* router = router_.GetIfBuilt();
+  if (router && !artifacts_.router) {
+    ostringstream output;
+    router->Serialize(output);
+    artifacts.router = output.str();
+  }
+  if (const TransportMap* map = map_.GetIfBuilt(); map && !artifacts_.map) {
+    artifacts.map = PackMapArtifact(map->RenderMap());
+  }
+  return artifacts;
+}
+
+TransportRouter* TransportCatalog::PrepareUpdate(bool are_stops_moved, bool are_buses_changed) {
+  TransportRouter* router = router_.GetIfBuilt();
+  if (are_stops_moved || are_buses_changed) {
+    map_.Reset();
+    artifacts_.map.reset();
+  } else {
+    map_.GetIfBuilt();  // its build reads the dicts
+  }
+  if (are_stops_moved) {
+    stops_index_.Reset();
+  } else {
+    stops_index_.GetIfBuilt();
+  }
+  timetable_router_.Reset();
+  artifacts_.router.reset();
+  is_updated_ = true;
+  return router;
+}
+
+void TransportCatalog::UpdateStop(Descriptions::Stop stop) {
+  // distances matter only for the router and the stats
+  const auto old_stop_it = stops_dict_.find(stop.name);
+  const bool is_stop_moved = old_stop_it == stops_dict_.end()
+      || old_stop_it->second->position.latitude != stop.position.latitude
+      || old_stop_it->second->position.longitude != stop.position.longitude;
+  TransportRouter* router = PrepareUpdate(is_stop_moved, false);
+  const auto& stored_stop = get<Descriptions::Stop>(data_.emplace_back(move(stop)));
+  stops_dict_[stored_stop.name] = &stored_stop;
+
+  // distances and positions of the stop matter only for the buses going through it
+  auto [stop_it, is_new_stop] = stops_.try_emplace(stored_stop.name);
+  if (is_new_stop) {
+    PrepareResponse(stop_it->second);
+  }
+  for (const string_view bus_name : stop_it->second.response.bus_names) {
+    auto& bus_entry = buses_.at(string(bus_name));
+    bus_entry.response = ComputeBusStats(*buses_dict_.at(string(bus_name)));
+    PrepareResponse(bus_entry);
+  }
+  if (router) {
+    router->Update(stops_dict_, buses_dict_, {stored_stop.name}, {});
+  }
+}
+
+void TransportCatalog::UpdateBus(Descriptions::Bus bus) {
+  TransportRouter* router = PrepareUpdate(false, true);
+  vector<string> changed_stop_names;
+  if (auto it = buses_dict_.find(bus.name); it != buses_dict_.end()) {
+    for (const string& stop_name : it->second->stops) {
+      EraseSorted(stops_.at(stop_name).response.bus_names, bus.name);
+    }
+    changed_stop_names = it->second->stops;
+  }
+
+  const auto& stored_bus = get<Descriptions::Bus>(data_.emplace_back(move(bus)));
+  buses_dict_[stored_bus.name] = &stored_bus;
+  auto& bus_entry = buses_[stored_bus.name];
+  bus_entry.response = ComputeBusStats(stored_bus);
+  PrepareResponse(bus_entry);
+  for (const string& stop_name : stored_bus.stops) {
+    InsertSorted(stops_.at(stop_name).response.bus_names, stored_bus.name);
+  }
+  changed_stop_names.insert(end(changed_stop_names), begin(stored_bus.stops), end(stored_bus.stops));
+  PrepareStopResponses(changed_stop_names);
+  if (router) {
+    router->Update(stops_dict_, buses_dict_, changed_stop_names, {stored_bus.name});
+  }
+}
+
+void TransportCatalog::RemoveStop(const string& name) {
+  assert(stops_.at(name).response.bus_names.empty());
+  TransportRouter* router = PrepareUpdate(true, false);
+  stops_dict_.erase(name);
+  const PreparedSpan& prepared = stops_.at(name).prepared;
+  prepared_responses_live_size_ -= prepared.end - prepared.begin;
+  stops_.erase(name);
+  if (router) {
+    router->Update(stops_dict_, buses_dict_, {name}, {});
+  }
+}
+
+void TransportCatalog::RemoveBus(const string& name) {
+  TransportRouter* router = PrepareUpdate(false, true);
+  const vector<string> changed_stop_names = buses_dict_.at(name)->stops;
+  for (const string& stop_name : changed_stop_names) {
+    EraseSorted(stops_.at(stop_name).response.bus_names, name);
+  }
+  buses_dict_.erase(name);
+  const PreparedSpan& prepared = buses_.at(name).prepared;
+  prepared_responses_live_size_ -= prepared.end - prepared.begin;
+  buses_.erase(name);
+  PrepareStopResponses(changed_stop_names);
+  if (router) {
+    router->Update(stops_dict_, buses_dict_, changed_stop_names, {name});
+  }
+}
+
+void TransportCatalog::PrepareRouter() const {
+  router_.StartBuild();
+}
+
+void TransportCatalog::PrepareMap() const {
+  map_.StartBuild();
+}
+
+void TransportCatalog::PrepareWholeMap() const {
+  if (!artifacts_.map) {
+    map_.StartBuild();
+  }
 }
 
 const TransportCatalog::Stop* TransportCatalog::GetStop(const string& name) const {
-  return GetValuePointer(stops_, name);
+  const auto* entry = GetValuePointer(stops_, name);
+  return entry ? &entry->response : nullptr;
 }
 
 const TransportCatalog::Bus* TransportCatalog::GetBus(const string& name) const {
-  return GetValuePointer(buses_, name);
+  const auto* entry = GetValuePointer(buses_, name);
+  return entry ? &entry->response : nullptr;
+}
+
+optional<TransportCatalog::PreparedResponse> TransportCatalog::GetPreparedStopResponse(const string& name) const {
+  return GetPreparedResponse(stops_, name);
+}
+
+optional<TransportCatalog::PreparedResponse> TransportCatalog::GetPreparedBusResponse(const string& name) const {
+  return GetPreparedResponse(buses_, name);
 }
 
 optional<TransportRouter::RouteInfo> TransportCatalog::FindRoute(const string& stop_from, const string& stop_to) const {
-  return router_->FindRoute(stop_from, stop_to);
+  return router_.Get().FindRoute(stop_from, stop_to);
+}
+
+optional<TransportRouter::RouteInfo> TransportCatalog::FindRoute(const string& stop_from, const string& stop_to,
+                                                                 double departure_time) const {
+  return timetable_router_.Get().FindRoute(stop_from, stop_to, departure_time);
+}
+
+optional<double> TransportCatalog::FindRouteTime(const string& stop_from, const string& stop_to) const {
+  return router_.Get().FindRouteTime(stop_from, stop_to);
+}
+
+TransportRouter::Stats TransportCatalog::GetRouterStats() const {
+  return router_.Get().GetStats();
+}
+
+vector<SubsystemMemory> TransportCatalog::GetMemoryStats() {
+  const MemoryUsage descriptions = ComputeMemoryUsage(data_) + ComputeMemoryUsage(stops_dict_)
+      + ComputeMemoryUsage(buses_dict_);
+  const MemoryUsage catalog = ComputeMemoryUsage(stops_) + ComputeMemoryUsage(buses_)
+      + ComputeMemoryUsage(prepared_responses_);
+  vector<SubsystemMemory> stats = {
+      {"descriptions", descriptions, descriptions},
+      {"catalog", catalog, catalog},
+  };
+  if (const TransportRouter* router = router_.GetIfBuilt()) {
+    for (auto& subsystem : router->GetMemoryStats()) {
+      stats.push_back(move(subsystem));
+    }
+  }
+  if (const TransportMap* map = map_.GetIfBuilt()) {
+    for (auto& subsystem : map->GetMemoryStats()) {
+      stats.push_back(move(subsystem));
+    }
+  }
+  return stats;
+}
+
+vector<StopsIndex::Item> TransportCatalog::FindNearestStops(Sphere::Point position, size_t count, double radius) const {
+  return stops_index_.Get().FindNearest(position, count, radius);
 }
 
 int TransportCatalog::ComputeRoadRouteLength(
-    const vector<string>& stops,
+    Descriptions::RouteView<string> stops,
     const Descriptions::StopsDict& stops_dict
 ) {
   int result = 0;
@@ -66,7 +410,7 @@ int TransportCatalog::ComputeRoadRouteLength(
 }
 
 double TransportCatalog::ComputeGeoRouteDistance(
-    const vector<string>& stops,
+    Descriptions::RouteView<string> stops,
     const Descriptions::StopsDict& stops_dict
 ) {
   double result = 0;
@@ -78,11 +422,10 @@ double TransportCatalog::ComputeGeoRouteDistance(
   return result;
 }
 
-std::string TransportCatalog::RenderMap() const {
-    
+static string EscapeQuotes(const string& svg) {
     string newmap;
 
-    for (auto symbol : map_->RenderMap()) {
+    for (auto symbol : svg) {
         if (symbol == '"') {
             newmap.push_back('\\');
         } 
@@ -92,6 +435,32 @@ std::string TransportCatalog::RenderMap() const {
     return newmap;
 }
 
+std::string TransportCatalog::RenderMap() const {
+    return EscapeQuotes(artifacts_.map ? *artifacts_.map : map_.Get().RenderMap());
+}
+
+std::string TransportCatalog::RenderMap(const vector<string>& layers) const {
+    return EscapeQuotes(map_.Get().RenderMap(layers));
+}
+
+std::string TransportCatalog::RenderMap(const TransportMap::Viewport& viewport) const {
+    return EscapeQuotes(map_.Get().RenderMap(viewport));
+}
+
+std::string TransportCatalog::RenderMap(const TransportMap::Viewport& viewport, const vector<string>& layers) const {
+    return EscapeQuotes(map_.Get().RenderMap(viewport, layers));
+}
+
+std::string TransportCatalog::RenderRoute(const TransportRouter::RouteInfo& route) const {
+    vector<TransportMap::RouteSpan> spans;
+    for (const auto& item : route.items) {
+        if (const auto* bus_item = get_if<TransportRouter::RouteInfo::BusItem>(&item)) {
+            spans.push_back({ bus_item->bus_name, bus_item->start_stop_idx, bus_item->span_count });
+        }
+    }
+    return EscapeQuotes(map_.Get().RenderRoute(spans));
+}
+
 std::string TransportCatalog::RenderMapDebug() const {
-    return map_->RenderMap();
+    return artifacts_.map ? *artifacts_.map : map_.Get().RenderMap();
 }
\ No newline at end of file
@@ -2,13 +2,17 @@
 
 #include "descriptions.h"
 #include "json.h"
+#include "memory_usage.h"
+#include "stops_index.h"
+#include "timetable_router.h"
 #include "transport_router.h"
 #include "utils.h"
 #include "transport_map.h"
 
+#include <deque>
 #include <optional>
-#include <set>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <variant>
 #include <vector>
@@ -16,7 +20,9 @@
 
 namespace Responses {
   struct Stop {
-    std::set<std::string> bus_names;
+    std::vector<std::string_view> bus_names;  // sorted, viewing the names in the bus descriptions
+
+    MemoryUsage GetMemoryUsage() const { return ComputeMemoryUsage(bus_names); }
   };
 
   struct Bus {
@@ -25,6 +31,10 @@ namespace Responses {
     int road_route_length = 0;
     double geo_route_length = 0.0;
   };
+
+  // Bodies of the answers to Stop and Bus requests
+  Json::Dict ToJson(const Stop& stop);
+  Json::Dict ToJson(const Bus& bus);
 }
 
 class TransportCatalog {
@@ -33,34 +43,122 @@ private:
   using Stop = Responses::Stop;
 
 public:
+  // Results of a previous build on the same base data and settings, see BuildCache
+  struct Artifacts {
+    std::optional<std::string> router;  // engines by TransportRouter::Serialize
+    std::optional<std::string> map;  // the whole map as RenderMap() draws it, behind a checked header
+  };
+
   TransportCatalog(std::vector<Descriptions::InputQuery> data, 
                     const Json::Dict& routing_settings_json,
-                    const Json::Dict& render_settings_json);
+                    const Json::Dict& render_settings_json,
+                    Artifacts artifacts = {});
+
+  // What has been built, not loaded, for the base data so far: nothing once it has been updated
+  Artifacts GetArtifacts();
+
+  // Start building the router/map in the background while other requests are answered
+  void PrepareRouter() const;
+  void PrepareMap() const;
+  // For RenderMap() without arguments only: a loaded map needs no build
+  void PrepareWholeMap() const;
 
   const Stop* GetStop(const std::string& name) const;
   const Bus* GetBus(const std::string& name) const;
 
+  // ToJson of the stop or bus printed at build time, split where the request id goes
+  struct PreparedResponse {
+    std::string_view before_request_id;
+    std::string_view after_request_id;
+  };
+  std::optional<PreparedResponse> GetPreparedStopResponse(const std::string& name) const;
+  std::optional<PreparedResponse> GetPreparedBusResponse(const std::string& name) const;
+
   std::optional<TransportRouter::RouteInfo> FindRoute(const std::string& stop_from, const std::string& stop_to) const;
+  // Over the bus timetables, leaving at departure_time
+  std::optional<TransportRouter::RouteInfo> FindRoute(const std::string& stop_from, const std::string& stop_to,
+                                                      double departure_time) const;
+  std::optional<double> FindRouteTime(const std::string& stop_from, const std::string& stop_to) const;
+  TransportRouter::Stats GetRouterStats() const;
+  // Descriptions, answers and, if they have been built, the router and the map;
+  // waits for their background builds
+  std::vector<SubsystemMemory> GetMemoryStats();
+
+  std::vector<StopsIndex::Item> FindNearestStops(Sphere::Point position, size_t count, double radius) const;
 
   std::string RenderMap() const;
+  std::string RenderMap(const std::vector<std::string>& layers) const;
+  std::string RenderMap(const TransportMap::Viewport& viewport) const;
+  std::string RenderMap(const TransportMap::Viewport& viewport, const std::vector<std::string>& layers) const;
+  std::string RenderRoute(const TransportRouter::RouteInfo& route) const;
   std::string RenderMapDebug() const;//Марина: а зачем здесь некая дебаг-реализация
 
+  // Changes of the network between requests. Stops of an updated bus must exist;
+  // a removed stop must not be used by any bus
+  void UpdateStop(Descriptions::Stop stop);
+  void UpdateBus(Descriptions::Bus bus);
+  void RemoveStop(const std::string& name);
+  void RemoveBus(const std::string& name);
+
 private:
+  struct PreparedSpan {
+    size_t begin = 0;
+    size_t request_id_pos = 0;
+    size_t end = 0;
+  };
+  template <typename Response>
+  struct Entry {
+    Response response;
+    PreparedSpan prepared;  // in prepared_responses_
+
+    MemoryUsage GetMemoryUsage() const { return ComputeMemoryUsage(response); }
+  };
+
+  template <typename Response>
+  void PrepareResponse(Entry<Response>& entry);
+  void PrepareStopResponses(const std::vector<std::string>& stop_names);
+  // Once the replaced answers take more of prepared_responses_ than the live ones, copies the live ones anew
+  void CompactPreparedResponses();
+  template <typename Response>
+  std::optional<PreparedResponse> GetPreparedResponse(const std::unordered_map<std::string, Entry<Response>>& entries,
+                                                      const std::string& name) const;
+
+  Bus ComputeBusStats(const Descriptions::Bus& bus) const;
+  // Waits for background builds and drops what the change invalidates: the map, if stops are added,
+  // removed or moved or buses change, and the stops index, if stops are; the router, if built, is patched
+  TransportRouter* PrepareUpdate(bool are_stops_moved, bool are_buses_changed);
+
   //Можно лучше: необязательное использование статического метода
   static int ComputeRoadRouteLength(
-      const std::vector<std::string>& stops,
+      Descriptions::RouteView<std::string> stops,
       const Descriptions::StopsDict& stops_dict
   );
 
   //Можно лучше: необязательное использование статического метода
   static double ComputeGeoRouteDistance(
-      const std::vector<std::string>& stops,
+      Descriptions::RouteView<std::string> stops,
       const Descriptions::StopsDict& stops_dict
   );
 
-  std::unordered_map<std::string, Stop> stops_;
-  std::unordered_map<std::string, Bus> buses_;
-  std::unique_ptr<TransportRouter> router_;
-  std::unique_ptr<TransportMap> map_;
-  
+  // Router and map are expensive and built only when a request needs them,
+  // so the descriptions they are built from are kept here.
+  // A deque keeps the dict pointers valid when updates add descriptions
+  std::deque<Descriptions::InputQuery> data_;
+  Descriptions::StopsDict stops_dict_;
+  Descriptions::BusesDict buses_dict_;
+  Json::Dict routing_settings_json_;
+  Json::Dict render_settings_json_;
+
+  Artifacts artifacts_;  // loaded ones
+  bool is_updated_ = false;
+
+  std::unordered_map<std::string, Entry<Stop>> stops_;
+  std::unordered_map<std::string, Entry<Bus>> buses_;
+  std::string prepared_responses_;  // updates add answers anew, compacted from time to time
+  size_t prepared_responses_live_size_ = 0;
+  Lazy<StopsIndex> stops_index_;
+  Lazy<TransportRouter> router_;
+  Lazy<TimetableRouter> timetable_router_;
+  Lazy<TransportMap> map_;
+
 };
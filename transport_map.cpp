@@ -1,4 +1,12 @@
 #include "transport_map.h"
+#include "trace.h"
+
+#include <atomic>
+#include <cmath>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std::placeholders;
 
 //Что за штучка?
 void Foo() {
@@ -9,10 +17,10 @@ TransportMap::TransportMap(const Descriptions::StopsDict& stops_dict,
     const Descriptions::BusesDict& buses_dict,
     const Json::Dict& render_settings_json)
     : render_settings_(MakeRenderSettings(render_settings_json)),
-    layer_processor_({ {"bus_lines", std::bind(&TransportMap::PrintBusLine,this)}
-                     , {"bus_labels", std::bind(&TransportMap::PrintBusLabels,this)}
-                     , {"stop_points", std::bind(&TransportMap::PrintStopPoints, this)}
-                     , {"stop_labels", std::bind(&TransportMap::PrintStopLabels, this)} }) {
+    layer_processor_({ {"bus_lines", std::bind(&TransportMap::PrintBusLine, this, _1, _2)}
+                     , {"bus_labels", std::bind(&TransportMap::PrintBusLabels, this, _1, _2)}
+                     , {"stop_points", std::bind(&TransportMap::PrintStopPoints, this, _1, _2)}
+                     , {"stop_labels", std::bind(&TransportMap::PrintStopLabels, this, _1, _2)} }) {
 
     //Можно лучше: инициализация переменных в отдельной строке
     double min_lat = 100.0, max_lat = 0.0, min_lon = 100.0, max_lon = 0.0;
@@ -21,16 +29,31 @@ TransportMap::TransportMap(const Descriptions::StopsDict& stops_dict,
         max_lat = std::max(max_lat, stop_pointer->position.latitude);
         min_lon = std::min(min_lon, stop_pointer->position.longitude);
         max_lon = std::max(max_lon, stop_pointer->position.longitude);
-        stops_[stop_name] = { stop_name , stop_pointer->position };
+        stops_.push_back({ stop_name , stop_pointer->position });
+    }
+    std::sort(stops_.begin(), stops_.end(), [](const Stop& lhs, const Stop& rhs) {
+        return lhs.name < rhs.name;
+    });
+    std::unordered_map<std::string_view, size_t> stop_indices;
+    for (size_t stop_idx = 0; stop_idx < stops_.size(); ++stop_idx) {
+        stop_indices[stops_[stop_idx].name] = stop_idx;
     }
 
     for (const auto& [bus_name, bus_pointer] : buses_dict) {
-        buses_[bus_name] = { bus_pointer->name, {bus_pointer->stops}, bus_pointer->is_roundtrip };
+        Bus bus = { bus_pointer->name, {}, bus_pointer->is_roundtrip };
+        bus.stops.reserve(bus_pointer->stops.size());
+        for (const auto& stop_name : bus_pointer->stops) {
+            bus.stops.push_back(stop_indices.at(stop_name));
+        }
+        buses_.push_back(std::move(bus));
     }
+    std::sort(buses_.begin(), buses_.end(), [](const Bus& lhs, const Bus& rhs) {
+        return lhs.name < rhs.name;
+    });
 
     CalculateRelativeCoordinates(min_lat, max_lat, min_lon, max_lon);
-    //Можно лучше: слишком маленькая процедура, лучше встроить код сюда
-    CreateMap();
+    BuildSpatialIndex(min_lat, max_lat, min_lon, max_lon);
+    RenderLayerFragments();
 }
 
 Svg::Color TransportMap::GetColorFromNode(const Json::Node& node) {
@@ -86,60 +109,232 @@ TransportMap::RenderSettings TransportMap::MakeRenderSettings(const Json::Dict&
                         l.push_back(n.AsString());
                     }
                     return l;
-                }()
+                }(),
+        .use_css_classes = json.count("use_css_classes") > 0 && json.at("use_css_classes").AsBool(),
+        .coordinate_precision = json.count("coordinate_precision") > 0 ? json.at("coordinate_precision").AsDouble() : 0.0,
+        .collapse_return_legs = json.count("collapse_return_legs") > 0 && json.at("collapse_return_legs").AsBool(),
+        .polylines_as_paths = json.count("polylines_as_paths") > 0 && json.at("polylines_as_paths").AsBool(),
+        .route_shade_opacity = json.count("route_shade_opacity") > 0
+            ? std::optional(json.at("route_shade_opacity").AsDouble()) : std::nullopt
     };
 }
 
-void TransportMap::CalculateRelativeCoordinates(double min_lat, double max_lat, double min_lon, double max_lon) {
+Svg::Point TransportMap::Projection::operator()(Sphere::Point position) const {
+    Svg::Point point = { (position.longitude - min_lon) * zoom_coef + padding,
+        (max_lat - position.latitude) * zoom_coef + padding };
+    if (precision > 0) {
+        point.x = std::round(point.x / precision) * precision;
+        point.y = std::round(point.y / precision) * precision;
+    }
+    return point;
+}
+
+TransportMap::Projection TransportMap::MakeProjection(double min_lat, double max_lat, double min_lon, double max_lon,
+    double width, double height, double padding, double precision) {
     //TODO: нельзя сравнивать с 0 разницу double, надо воспользоваться относительным или абсолютным порогом
     double width_zoom_coef = (max_lon - min_lon == 0) ? std::numeric_limits<double>::max() :
-        (render_settings_.width - 2 * render_settings_.padding) / (max_lon - min_lon);
+        (width - 2 * padding) / (max_lon - min_lon);
     double height_zoom_coef = (max_lat - min_lat == 0) ? std::numeric_limits<double>::max() :
-        (render_settings_.height - 2 * render_settings_.padding) / (max_lat - min_lat);
+        (height - 2 * padding) / (max_lat - min_lat);
     double zoom_coef = std::min(width_zoom_coef, height_zoom_coef);
     if (zoom_coef == std::numeric_limits<double>::max()) {
         zoom_coef = 0;
     }
+    return { min_lon, max_lat, zoom_coef, padding, precision };
+}
+
+void TransportMap::CalculateRelativeCoordinates(double min_lat, double max_lat, double min_lon, double max_lon) {
+    const Projection projection = MakeProjection(min_lat, max_lat, min_lon, max_lon,
+        render_settings_.width, render_settings_.height, render_settings_.padding, render_settings_.coordinate_precision);
+    for (auto& bus_stop : stops_) {
+        bus_stop.out_coordinates = projection(bus_stop.position);
+    }
+}
+
+std::vector<TransportMap::SegmentId> TransportMap::GetBusLabelStops() const {
+    std::vector<SegmentId> label_stops;
+    for (size_t bus_idx = 0; bus_idx < buses_.size(); ++bus_idx) {
+        const Bus& bus = buses_[bus_idx];
+        label_stops.push_back({ bus_idx, 0 });
+        // у некольцевого маршрута номер выводится и на второй конечной
+        const size_t turn_index = bus.GetRoute().GetTurnIdx();
+        if ((!bus.is_roundtrip) && (bus.stops.front() != bus.stops[turn_index])) {
+            label_stops.push_back({ bus_idx, turn_index });
+        }
+    }
+    return label_stops;
+}
 
-    for (auto& [name, bus_stop] : stops_) {
-        bus_stop.out_coordinates =
-        { (bus_stop.position.longitude - min_lon) * zoom_coef + render_settings_.padding,
-        (max_lat - bus_stop.position.latitude) * zoom_coef + render_settings_.padding };
+size_t TransportMap::GetDrawnStopCount(const Bus& bus) const {
+    // обратный путь некольцевого маршрута повторяет прямой
+    if (render_settings_.collapse_return_legs && !bus.is_roundtrip) {
+        return bus.stops.size();
     }
+    return bus.GetRoute().size();
 }
 
-void TransportMap::PrintBusLine() {
+bool TransportMap::IsBusLabelStop(const Bus& bus, size_t stop_idx) const {
+    return stop_idx == bus.stops.front()
+        || (!bus.is_roundtrip && stop_idx == bus.stops.back());
+}
+
+void TransportMap::BuildSpatialIndex(double min_lat, double max_lat, double min_lon, double max_lon) {
+    // x - долгота, y - широта
+    const BoundingBox bounds = { min_lon, min_lat, max_lon, max_lat };
+
+    stops_grid_ = std::make_unique<SpatialGrid<size_t>>(bounds, stops_.size());
+    for (size_t stop_idx = 0; stop_idx < stops_.size(); ++stop_idx) {
+        const Sphere::Point& position = stops_[stop_idx].position;
+        stops_grid_->AddPoint(stop_idx, position.longitude, position.latitude);
+    }
+
+    size_t segment_count = 0;
+    for (const Bus& bus : buses_) {
+        segment_count += bus.GetRoute().size();
+    }
+    segments_grid_ = std::make_unique<SpatialGrid<SegmentId>>(bounds, segment_count);
+    for (size_t bus_idx = 0; bus_idx < buses_.size(); ++bus_idx) {
+        const auto bus_stops = buses_[bus_idx].GetRoute();
+        for (size_t stop_idx = 0; stop_idx + 1 < bus_stops.size(); ++stop_idx) {
+            const Sphere::Point& from = stops_[bus_stops[stop_idx]].position;
+            const Sphere::Point& to = stops_[bus_stops[stop_idx + 1]].position;
+            segments_grid_->AddSegment({ bus_idx, stop_idx }, from.longitude, from.latitude, to.longitude, to.latitude);
+        }
+    }
+
+    const auto label_stops = GetBusLabelStops();
+    bus_labels_grid_ = std::make_unique<SpatialGrid<SegmentId>>(bounds, label_stops.size());
+    for (const auto& [bus_idx, stop_idx] : label_stops) {
+        const Sphere::Point& position = stops_[buses_[bus_idx].GetRoute()[stop_idx]].position;
+        bus_labels_grid_->AddPoint({ bus_idx, stop_idx }, position.longitude, position.latitude);
+    }
+}
+
+TransportMap::Scene TransportMap::MakeFullScene() const {
+    Scene scene;
+    for (size_t bus_idx = 0; bus_idx < buses_.size(); ++bus_idx) {
+        const auto bus_stops = buses_[bus_idx].GetRoute();
+        Scene::BusLine bus_line = { bus_idx, {} };
+        for (size_t idx = 0; idx < GetDrawnStopCount(buses_[bus_idx]); ++idx) {
+            bus_line.points.push_back(stops_[bus_stops[idx]].out_coordinates);
+        }
+        scene.bus_lines.push_back(std::move(bus_line));
+    }
+    for (const auto& [bus_idx, stop_idx] : GetBusLabelStops()) {
+        scene.bus_labels.push_back({ bus_idx, stops_[buses_[bus_idx].GetRoute()[stop_idx]].out_coordinates });
+    }
+    for (size_t stop_idx = 0; stop_idx < stops_.size(); ++stop_idx) {
+        scene.stop_points.push_back({ stop_idx, stops_[stop_idx].out_coordinates });
+    }
+    scene.stop_labels = scene.stop_points;
+    return scene;
+}
+
+TransportMap::Scene TransportMap::MakeViewportScene(const BoundingBox& box, const Projection& projection) const {
+    Scene scene;
+
+    // соседние видимые отрезки одного маршрута склеиваются в одну ломаную
+    std::optional<SegmentId> prev_segment;
+    for (const auto& segment : segments_grid_->FindIntersecting(box)) {
+        const auto& [bus_idx, stop_idx] = segment;
+        const auto bus_stops = buses_[bus_idx].GetRoute();
+        if (stop_idx + 1 >= GetDrawnStopCount(buses_[bus_idx])) {
+            continue;
+        }
+        if (!prev_segment || *prev_segment != SegmentId{ bus_idx, stop_idx - 1 }) {
+            scene.bus_lines.push_back({ bus_idx, { projection(stops_[bus_stops[stop_idx]].position) } });
+        }
+        scene.bus_lines.back().points.push_back(projection(stops_[bus_stops[stop_idx + 1]].position));
+        prev_segment = segment;
+    }
+
+    for (const auto& [bus_idx, stop_idx] : bus_labels_grid_->FindIntersecting(box)) {
+        scene.bus_labels.push_back({ bus_idx, projection(stops_[buses_[bus_idx].GetRoute()[stop_idx]].position) });
+    }
+
+    for (const size_t stop_idx : stops_grid_->FindIntersecting(box)) {
+        scene.stop_points.push_back({ stop_idx, projection(stops_[stop_idx].position) });
+    }
+    scene.stop_labels = scene.stop_points;
+
+    return scene;
+}
+
+TransportMap::Scene TransportMap::MakeRouteScene(const std::vector<RouteSpan>& spans) const {
+    Scene scene;
+    // остановка пересадки - конец одного отрезка и начало следующего, кружок на ней нужен один
+    std::vector<bool> stop_drawn(stops_.size(), false);
+    for (const auto& span : spans) {
+        const auto bus_it = std::lower_bound(buses_.begin(), buses_.end(), span.bus_name,
+            [](const Bus& bus, std::string_view name) { return bus.name < name; });
+        if (bus_it == buses_.end() || bus_it->name != span.bus_name) {
+            throw std::runtime_error("Unknown bus on route: " + std::string(span.bus_name));
+        }
+        const size_t bus_idx = bus_it - buses_.begin();
+        const auto bus_stops = bus_it->GetRoute();
+        const size_t finish_stop_idx = span.start_stop_idx + span.span_count;
+
+        Scene::BusLine bus_line = { bus_idx, {} };
+        for (size_t idx = span.start_stop_idx; idx <= finish_stop_idx; ++idx) {
+            bus_line.points.push_back(stops_[bus_stops[idx]].out_coordinates);
+            if (!stop_drawn[bus_stops[idx]]) {
+                stop_drawn[bus_stops[idx]] = true;
+                scene.stop_points.push_back({ bus_stops[idx], stops_[bus_stops[idx]].out_coordinates });
+            }
+        }
+        scene.bus_lines.push_back(std::move(bus_line));
+
+        // номер автобуса подписывается только на конечных
+        for (const size_t idx : { span.start_stop_idx, finish_stop_idx }) {
+            if (IsBusLabelStop(*bus_it, bus_stops[idx])) {
+                scene.bus_labels.push_back({ bus_idx, stops_[bus_stops[idx]].out_coordinates });
+            }
+        }
+
+        // названия остановок - там, где начинается поездка, и в конце маршрута
+        scene.stop_labels.push_back({ bus_stops[span.start_stop_idx], stops_[bus_stops[span.start_stop_idx]].out_coordinates });
+        if (&span == &spans.back()) {
+            scene.stop_labels.push_back({ bus_stops[finish_stop_idx], stops_[bus_stops[finish_stop_idx]].out_coordinates });
+        }
+    }
+    return scene;
+}
+
+void TransportMap::PrintBusLine(const Scene& scene, Svg::Document& document) const {
 
     // 0. Маршруты автобусов.
-    size_t cnt = 0;
-    for (const auto& [bus_name, bus_param] : buses_) {
-        Svg::Polyline bus_route;
-        size_t col_index = cnt % render_settings_.color_palette.size();
-        bus_route.SetStrokeColor(render_settings_.color_palette[col_index]);
-        bus_route.SetStrokeWidth(render_settings_.line_width);
-        bus_route.SetStrokeLineCap("round");
-        bus_route.SetStrokeLineJoin("round");
-        for (const auto& bus_stop_name : bus_param.stops) {
-            bus_route.AddPoint(stops_.at(bus_stop_name).out_coordinates);
+    for (const auto& bus_line : scene.bus_lines) {
+        auto draw_line = [&](auto bus_route) {
+            size_t col_index = bus_line.bus_idx % render_settings_.color_palette.size();
+            bus_route.SetStrokeColor(render_settings_.color_palette[col_index]);
+            bus_route.SetStrokeWidth(render_settings_.line_width);
+            bus_route.SetStrokeLineCap("round");
+            bus_route.SetStrokeLineJoin("round");
+            for (const auto& point : bus_line.points) {
+                bus_route.AddPoint(point);
+            }
+            //для std::move должна быть семантика rvalue, проверьте Document
+            document.Add(std::move(bus_route));
+        };
+        if (render_settings_.polylines_as_paths) {
+            draw_line(Svg::Path{});
+        } else {
+            draw_line(Svg::Polyline{});
         }
-        //для std::move должна быть семантика rvalue, проверьте Document
-        map_.Add(std::move(bus_route));
-        cnt++;
     }
 
 }
-void TransportMap::PrintBusLabels() {
+void TransportMap::PrintBusLabels(const Scene& scene, Svg::Document& document) const {
 
     // 1. Номера автобусов
-    size_t cnt = 0;
-    for (const auto& [bus_name, bus_param] : buses_) {
+    for (const auto& bus_label : scene.bus_labels) {
         Svg::Text bus_name_pdl;
-        bus_name_pdl.SetPoint(stops_[bus_param.stops.front()].out_coordinates);
+        bus_name_pdl.SetPoint(bus_label.point);
         bus_name_pdl.SetOffset(render_settings_.bus_label_offset);
         bus_name_pdl.SetFontSize(render_settings_.bus_label_font_size);
         bus_name_pdl.SetFontFamily("Verdana");
         bus_name_pdl.SetFontWeight("bold");
-        bus_name_pdl.SetData(bus_name);
+        bus_name_pdl.SetData(buses_[bus_label.bus_idx].name);
 
         auto bus_name_txt = bus_name_pdl;
 
@@ -149,47 +344,36 @@ void TransportMap::PrintBusLabels() {
         bus_name_pdl.SetStrokeLineCap("round");
         bus_name_pdl.SetStrokeLineJoin("round");
 
-        size_t col_index = cnt % render_settings_.color_palette.size();
+        size_t col_index = bus_label.bus_idx % render_settings_.color_palette.size();
         bus_name_txt.SetFillColor(render_settings_.color_palette[col_index]);
 
-        map_.Add(bus_name_pdl);
-        map_.Add(bus_name_txt);
-
-        //Можно лучше: добавить комментарий с описанием назначения блока
-        size_t middle_index = bus_param.stops.size() / 2;
-        if ((!bus_param.is_roundtrip) && (bus_param.stops.front() != bus_param.stops[middle_index])) {
-            bus_name_pdl.SetPoint(stops_[bus_param.stops[middle_index]].out_coordinates);
-            bus_name_txt.SetPoint(stops_[bus_param.stops[middle_index]].out_coordinates);
-            map_.Add(std::move(bus_name_pdl));
-            map_.Add(std::move(bus_name_txt));
-        }
-
-        cnt++;
+        document.Add(std::move(bus_name_pdl));
+        document.Add(std::move(bus_name_txt));
     }
 }
 
-void TransportMap::PrintStopPoints() {
+void TransportMap::PrintStopPoints(const Scene& scene, Svg::Document& document) const {
     //Можно лучше: комментарий очевидный
     // 2. Круги автобусных остановок
-    for (const auto& [stop_name, stop_param] : stops_) {
+    for (const auto& stop_mark : scene.stop_points) {
         Svg::Circle stop_circle;
         stop_circle.SetRadius(render_settings_.stop_radius);
         stop_circle.SetFillColor("white");
-        stop_circle.SetCenter(stop_param.out_coordinates);
-        map_.Add(std::move(stop_circle));
+        stop_circle.SetCenter(stop_mark.point);
+        document.Add(std::move(stop_circle));
     }
 }
-void TransportMap::PrintStopLabels() {
+void TransportMap::PrintStopLabels(const Scene& scene, Svg::Document& document) const {
     //Можно лучше: комментарий очевидный
     // 3. Названия автобусных остановок
-    for (const auto& [stop_name, stop_param] : stops_) {
+    for (const auto& stop_mark : scene.stop_labels) {
         //нельзя использовать транслитерацию
         Svg::Text nadpis;
-        nadpis.SetPoint(stop_param.out_coordinates);
+        nadpis.SetPoint(stop_mark.point);
         nadpis.SetOffset(render_settings_.stop_label_offset);
         nadpis.SetFontSize(render_settings_.stop_label_font_size);
         nadpis.SetFontFamily("Verdana");
-        nadpis.SetData(stop_name);
+        nadpis.SetData(stops_[stop_mark.stop_idx].name);
 
         //нельзя использовать транслитерацию
         auto podlozhka = nadpis;
@@ -200,30 +384,216 @@ void TransportMap::PrintStopLabels() {
         podlozhka.SetStrokeLineJoin("round");
 
         nadpis.SetFillColor("black");
-        map_.Add(std::move(podlozhka));
-        map_.Add(std::move(nadpis));
+        document.Add(std::move(podlozhka));
+        document.Add(std::move(nadpis));
+    }
+}
+
+Svg::Document TransportMap::CreateLayers(const Scene& scene, const std::vector<std::string>& layers) const {
+    Svg::Document document;
+    for (const std::string& layer : layers) {
+        const auto processor_it = layer_processor_.find(layer);
+        if (processor_it == layer_processor_.end()) {
+            throw std::runtime_error("Unknown map layer: " + layer);
+        }
+        TRACE_SCOPE("TransportMap layer " + layer);
+        processor_it->second(scene, document);
+    }
+    return document;
+}
+
+template <typename T>
+static std::vector<std::vector<T>> SplitIntoChunks(std::vector<T> items, size_t chunk_count) {
+    std::vector<std::vector<T>> chunks(chunk_count);
+    for (size_t chunk_idx = 0; chunk_idx < chunk_count; ++chunk_idx) {
+        const auto chunk_begin = items.begin() + items.size() * chunk_idx / chunk_count;
+        const auto chunk_end = items.begin() + items.size() * (chunk_idx + 1) / chunk_count;
+        chunks[chunk_idx].assign(std::make_move_iterator(chunk_begin), std::make_move_iterator(chunk_end));
+    }
+    return chunks;
+}
+
+std::vector<TransportMap::Scene> TransportMap::SplitScene(Scene scene, size_t chunk_count) {
+    auto bus_lines = SplitIntoChunks(std::move(scene.bus_lines), chunk_count);
+    auto bus_labels = SplitIntoChunks(std::move(scene.bus_labels), chunk_count);
+    auto stop_points = SplitIntoChunks(std::move(scene.stop_points), chunk_count);
+    auto stop_labels = SplitIntoChunks(std::move(scene.stop_labels), chunk_count);
+    std::vector<Scene> chunks(chunk_count);
+    for (size_t chunk_idx = 0; chunk_idx < chunk_count; ++chunk_idx) {
+        chunks[chunk_idx] = { std::move(bus_lines[chunk_idx]), std::move(bus_labels[chunk_idx]),
+            std::move(stop_points[chunk_idx]), std::move(stop_labels[chunk_idx]) };
+    }
+    return chunks;
+}
+
+// Задачи с номерами [0, task_count) разбираются не более чем hardware_concurrency потоками
+template <typename Task>
+static void RunInParallel(size_t task_count, const Task& task) {
+    const size_t thread_count = std::min<size_t>(task_count, std::max(1u, std::thread::hardware_concurrency()));
+    std::atomic<size_t> next_task_idx = 0;
+    std::vector<std::future<void>> workers;
+    for (size_t thread_idx = 0; thread_idx < thread_count; ++thread_idx) {
+        workers.push_back(std::async(std::launch::async, [&] {
+            for (size_t task_idx; (task_idx = next_task_idx++) < task_count; ) {
+                task(task_idx);
+            }
+        }));
+    }
+    for (auto& worker : workers) {
+        worker.get();
+    }
+}
+
+void TransportMap::RenderLayerFragments() {
+    // Слои и части слоёв рисуются в отдельных потоках, а склеиваются в исходном порядке,
+    // поэтому результат не отличается от последовательной отрисовки
+    const size_t min_chunk_size = 512;
+    Scene scene = MakeFullScene();
+    const size_t max_list_size = std::max({ scene.bus_lines.size(), scene.bus_labels.size(),
+        scene.stop_points.size(), scene.stop_labels.size() });
+    const size_t chunk_count = std::clamp<size_t>(max_list_size / min_chunk_size, 1,
+        std::max(1u, std::thread::hardware_concurrency()));
+    const std::vector<Scene> chunks = SplitScene(std::move(scene), chunk_count);
+
+    struct Part {
+        Svg::Document document;
+        Svg::StyleSheet style_sheet;
+        std::string svg;
+    };
+    std::vector<std::string> layers;
+    std::vector<const std::function<void(const Scene&, Svg::Document&)>*> processors;
+    for (const auto& [layer, processor] : layer_processor_) {
+        layers.push_back(layer);
+        processors.push_back(&processor);
+    }
+    // part_idx = layer_idx * chunk_count + chunk_idx
+    std::vector<Part> parts(layers.size() * chunk_count);
+    RunInParallel(parts.size(), [&](size_t part_idx) {
+        const size_t layer_idx = part_idx / chunk_count;
+        TRACE_SCOPE("TransportMap layer " + layers[layer_idx]);
+        Part& part = parts[part_idx];
+        (*processors[layer_idx])(chunks[part_idx % chunk_count], part.document);
+        if (render_settings_.use_css_classes) {
+            part.document.CollectStyles(part.style_sheet);
+        } else {
+            std::stringstream ss;
+            part.document.RenderObjects(ss);
+            part.svg = ss.str();
+        }
+    });
+    for (const Part& part : parts) {
+        svg_documents_peak_ += part.document.GetMemoryUsage() + part.style_sheet.GetMemoryUsage();
+    }
+
+    if (render_settings_.use_css_classes) {
+        // номера классов раздаются в порядке первого появления, как при последовательной отрисовке
+        for (const Part& part : parts) {
+            style_sheet_.Merge(part.style_sheet);
+        }
+        RunInParallel(parts.size(), [&](size_t part_idx) {
+            std::stringstream ss;
+            parts[part_idx].document.RenderObjects(ss, &style_sheet_);
+            parts[part_idx].svg = ss.str();
+        });
+    }
+
+    for (size_t layer_idx = 0; layer_idx < layers.size(); ++layer_idx) {
+        std::string& fragment = layer_fragments_[layers[layer_idx]];
+        for (size_t chunk_idx = 0; chunk_idx < chunk_count; ++chunk_idx) {
+            fragment += parts[layer_idx * chunk_count + chunk_idx].svg;
+        }
     }
+    for (const std::string& layer : render_settings_.layers) {
+        base_map_ += layer_fragments_.at(layer);
+    }
+}
+
+std::vector<SubsystemMemory> TransportMap::GetMemoryStats() const {
+    const MemoryUsage map = ComputeMemoryUsage(stops_) + ComputeMemoryUsage(buses_)
+        + ComputeMemoryUsage(stops_grid_) + ComputeMemoryUsage(segments_grid_) + ComputeMemoryUsage(bus_labels_grid_)
+        + ComputeMemoryUsage(layer_fragments_) + ComputeMemoryUsage(base_map_) + style_sheet_.GetMemoryUsage();
+    return {
+        { "map", map, map },
+        { "svg_documents", {}, svg_documents_peak_ },
+    };
 }
 
-void TransportMap::CreateMap() {
-	
-   /* PrintBusLine();
-    PrintBusLabels();
-    PrintStopPoints();
-    PrintStopLabels();*/
-    //layer_processor_.at("bus_lines")();
-    //layer_processor_.at("bus_labels")();
-    //layer_processor_.at("stop_points")();
-    //layer_processor_.at("stop_labels")();
-    for (const std::string layer : render_settings_.layers) {
-        layer_processor_.at(layer)();
+std::string TransportMap::RenderMap() const {
+    std::stringstream ss;
+    Svg::Document::RenderHeader(ss);
+    style_sheet_.Render(ss);
+    ss << base_map_;
+    Svg::Document::RenderFooter(ss);
+    return ss.str();
+}
+
+std::string TransportMap::RenderMap(const std::vector<std::string>& layers) const {
+    std::stringstream ss;
+    Svg::Document::RenderHeader(ss);
+    style_sheet_.Render(ss);
+    for (const std::string& layer : layers) {
+        const auto fragment_it = layer_fragments_.find(layer);
+        if (fragment_it == layer_fragments_.end()) {
+            throw std::runtime_error("Unknown map layer: " + layer);
+        }
+        ss << fragment_it->second;
     }
-     
+    Svg::Document::RenderFooter(ss);
+    return ss.str();
+}
+
+std::string TransportMap::RenderMap(const Viewport& viewport) const {
+    return RenderMap(viewport, render_settings_.layers);
 }
 
-std::string TransportMap::RenderMap() {
+std::string TransportMap::RenderMap(const Viewport& viewport, const std::vector<std::string>& layers) const {
+    const Projection projection = MakeProjection(viewport.min.latitude, viewport.max.latitude,
+        viewport.min.longitude, viewport.max.longitude,
+        viewport.width.value_or(render_settings_.width), viewport.height.value_or(render_settings_.height), 0.0,
+        render_settings_.coordinate_precision);
+    const BoundingBox box = { viewport.min.longitude, viewport.min.latitude,
+        viewport.max.longitude, viewport.max.latitude };
+
+    // холст ровно того размера, под который спроецирован вид
+    Svg::Document document = CreateLayers(MakeViewportScene(box, projection), layers);
+    document.SetSize({ viewport.width.value_or(render_settings_.width), viewport.height.value_or(render_settings_.height) });
     std::stringstream ss;
-    map_.Render(ss);
+    document.Render(ss, render_settings_.use_css_classes);
     return ss.str();
 }
 
+std::string TransportMap::RenderRoute(const std::vector<RouteSpan>& spans) const {
+    Svg::Document overlay;
+    Svg::Rect shade;
+    shade.SetPoint({ 0, 0 });
+    shade.SetWidth(render_settings_.width);
+    shade.SetHeight(render_settings_.height);
+    shade.SetFillColor(render_settings_.underlayer_color);
+    // без настройки полупрозрачна сама подложка, а непрозрачный цвет скрыл бы карту целиком
+    if (render_settings_.route_shade_opacity) {
+        shade.SetFillOpacity(*render_settings_.route_shade_opacity);
+    } else if (!render_settings_.underlayer_color.HasAlpha()) {
+        shade.SetFillOpacity(DEFAULT_ROUTE_SHADE_OPACITY);
+    }
+    overlay.Add(std::move(shade));
+    const Scene scene = MakeRouteScene(spans);
+    for (const std::string& layer : render_settings_.layers) {
+        layer_processor_.at(layer)(scene, overlay);
+    }
+
+    // классы подложки дополняются классами наложения
+    Svg::StyleSheet style_sheet = style_sheet_;
+    if (render_settings_.use_css_classes) {
+        overlay.CollectStyles(style_sheet);
+    }
+    std::stringstream overlay_ss;
+    overlay.RenderObjects(overlay_ss, render_settings_.use_css_classes ? &style_sheet : nullptr);
+
+    std::stringstream ss;
+    Svg::Document::RenderHeader(ss);
+    style_sheet.Render(ss);
+    ss << base_map_;
+    ss << overlay_ss.str();
+    Svg::Document::RenderFooter(ss);
+    return ss.str();
+}
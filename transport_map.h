@@ -3,26 +3,64 @@
 #include "svg.h"
 #include "sphere.h"
 #include "descriptions.h"
+#include "spatial_grid.h"
+#include "memory_usage.h"
+#include <cstdint>
 #include <vector>
 #include <map>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <stdexcept>
 #include <algorithm>
 #include <limits>
 #include <sstream>
 #include <functional>
+#include <future>
+#include <thread>
 
 class TransportMap
 {
 public:
+	// Of the whole map artifact the catalog caches; bump when RenderMap() output changes
+	static constexpr uint32_t FORMAT_VERSION = 2;
+
 	TransportMap(const Descriptions::StopsDict& stops_dict,
 		const Descriptions::BusesDict& buses_dict,
 		const Json::Dict& routing_settings_json);
-	
-	std::string RenderMap();
+
+	std::string RenderMap() const;
+	// Any subset of the layers in any order, glued from the pre-rendered fragments
+	std::string RenderMap(const std::vector<std::string>& layers) const;
+
+	// Part of the map within the lat/lon box, scaled to fit width x height (render settings by default)
+	struct Viewport {
+		Sphere::Point min;
+		Sphere::Point max;
+		std::optional<double> width;
+		std::optional<double> height;
+	};
+	std::string RenderMap(const Viewport& viewport) const;
+	std::string RenderMap(const Viewport& viewport, const std::vector<std::string>& layers) const;
+
+	// Ride along bus route stops [start_stop_idx, start_stop_idx + span_count]
+	struct RouteSpan {
+		std::string_view bus_name;
+		size_t start_stop_idx;
+		size_t span_count;
+	};
+	// The whole map shaded by a translucent overlay with the itinerary drawn on top
+	std::string RenderRoute(const std::vector<RouteSpan>& spans) const;
+
+	// Scenes, spatial indices and pre-rendered fragments; the documents of the layers exist only while they are rendered
+	std::vector<SubsystemMemory> GetMemoryStats() const;
 
 private:
+	// Для подложки маршрута без route_shade_opacity и без альфа-канала в underlayer_color
+	static constexpr double DEFAULT_ROUTE_SHADE_OPACITY = 0.85;
+
 	struct RenderSettings {
 		double width;
 		double height;
@@ -37,37 +75,97 @@ private:
 		int bus_label_font_size;
 		Svg::Point bus_label_offset;
 		std::vector<std::string> layers;
+		bool use_css_classes;  // оформление элементов выносится в общий блок <style>
+		// Компактный вывод
+		double coordinate_precision;  // шаг округления координат в пикселях, 0 - без округления
+		bool collapse_return_legs;  // обратный путь некольцевого маршрута не рисуется повторно
+		bool polylines_as_paths;
+		// Прозрачность подложки под маршрутом на карте ответа Route
+		std::optional<double> route_shade_opacity;
 	};
 
 	struct Stop {
 		std::string name;
 		Sphere::Point position;
 		Svg::Point out_coordinates;
+
+		MemoryUsage GetMemoryUsage() const { return ComputeMemoryUsage(name); }
 	};
 
 	struct Bus {
 		std::string name;
-		std::vector<std::string> stops;
+		std::vector<size_t> stops;  // indices in stops_, forward only
 		bool is_roundtrip;
+
+		Descriptions::RouteView<size_t> GetRoute() const { return { stops, is_roundtrip }; }
+		MemoryUsage GetMemoryUsage() const { return ComputeMemoryUsage(name) + ComputeMemoryUsage(stops); }
+	};
+
+	struct Projection {
+		double min_lon;
+		double max_lat;
+		double zoom_coef;
+		double padding;
+		double precision;
+		Svg::Point operator()(Sphere::Point position) const;
+	};
+
+	// What the layer processors draw: either the whole network or its visible part
+	struct Scene {
+		struct BusLine {
+			size_t bus_idx;
+			std::vector<Svg::Point> points;
+		};
+		struct BusLabel {
+			size_t bus_idx;
+			Svg::Point point;
+		};
+		struct StopMark {
+			size_t stop_idx;
+			Svg::Point point;
+		};
+		std::vector<BusLine> bus_lines;
+		std::vector<BusLabel> bus_labels;
+		std::vector<StopMark> stop_points;
+		std::vector<StopMark> stop_labels;
 	};
 
+	// (bus index, index of the first stop) in drawing order
+	using SegmentId = std::pair<size_t, size_t>;
+
     //Не надо делать статическим методом, от членов класса, не зависит, уменьшить область видимости или даже перенести
 	static RenderSettings MakeRenderSettings(const Json::Dict& json);
 	//тоже самое
     static Svg::Color GetColorFromNode(const Json::Node& node);
+	static Projection MakeProjection(double min_lat, double max_lat, double min_lon, double max_lon,
+		double width, double height, double padding, double precision);
+	size_t GetDrawnStopCount(const Bus& bus) const;
 	void CalculateRelativeCoordinates(double min_lat, double max_lat, double min_lon, double max_lon);
-	void PrintBusLine();
-	void PrintBusLabels();
-	void PrintStopPoints();
-	void PrintStopLabels();
-	void CreateMap();
+	void BuildSpatialIndex(double min_lat, double max_lat, double min_lon, double max_lon);
+	std::vector<SegmentId> GetBusLabelStops() const;
+	Scene MakeFullScene() const;
+	Scene MakeViewportScene(const BoundingBox& box, const Projection& projection) const;
+	Scene MakeRouteScene(const std::vector<RouteSpan>& spans) const;
+	static std::vector<Scene> SplitScene(Scene scene, size_t chunk_count);
+	bool IsBusLabelStop(const Bus& bus, size_t stop_idx) const;
+	void PrintBusLine(const Scene& scene, Svg::Document& document) const;
+	void PrintBusLabels(const Scene& scene, Svg::Document& document) const;
+	void PrintStopPoints(const Scene& scene, Svg::Document& document) const;
+	void PrintStopLabels(const Scene& scene, Svg::Document& document) const;
+	Svg::Document CreateLayers(const Scene& scene, const std::vector<std::string>& layers) const;
+	void RenderLayerFragments();
 
 
 	RenderSettings render_settings_;
-	std::map<std::string, Stop> stops_;
-	std::map<std::string, Bus> buses_;
-	Svg::Document map_;
-	const std::map<std::string, std::function<void()>> layer_processor_;
-	std::vector<std::string> layers_;
+	std::vector<Stop> stops_;  // sorted by name
+	std::vector<Bus> buses_;  // sorted by name
+	std::unique_ptr<SpatialGrid<size_t>> stops_grid_;
+	std::unique_ptr<SpatialGrid<SegmentId>> segments_grid_;
+	std::unique_ptr<SpatialGrid<SegmentId>> bus_labels_grid_;
+	const std::map<std::string, std::function<void(const Scene&, Svg::Document&)>> layer_processor_;
+	std::map<std::string, std::string> layer_fragments_;
+	std::string base_map_;  // fragments glued in render_settings_.layers order
+	Svg::StyleSheet style_sheet_;  // classes referenced by the fragments
+	MemoryUsage svg_documents_peak_;  // all parts of all layers before they are glued
 };
 
@@ -1,87 +1,692 @@
 #include "transport_router.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <string_view>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_set>
 
 using namespace std;
 
+namespace {
+  // Position of the cell (x, y) on the Hilbert curve filling a 2^16 x 2^16 grid
+  uint64_t ComputeHilbertIndex(uint32_t x, uint32_t y) {
+    uint64_t index = 0;
+    for (uint32_t half = 1u << 15; half > 0; half >>= 1) {
+      const uint32_t rx = (x & half) > 0;
+      const uint32_t ry = (y & half) > 0;
+      index += static_cast<uint64_t>(half) * half * ((3 * rx) ^ ry);
+      if (ry == 0) {
+        if (rx == 1) {
+          x = half - 1 - (x & (half - 1));
+          y = half - 1 - (y & (half - 1));
+        }
+        swap(x, y);
+      }
+    }
+    return index;
+  }
+}
+
 
 TransportRouter::TransportRouter(const Descriptions::StopsDict& stops_dict,
                                  const Descriptions::BusesDict& buses_dict,
                                  const Json::Dict& routing_settings_json)
     : routing_settings_(MakeRoutingSettings(routing_settings_json))
 {
+  Build(stops_dict, buses_dict);
+}
+
+TransportRouter::TransportRouter(const Descriptions::StopsDict& stops_dict,
+                                 const Descriptions::BusesDict& buses_dict,
+                                 const Json::Dict& routing_settings_json,
+                                 istream& engines_input)
+    : routing_settings_(MakeRoutingSettings(routing_settings_json))
+{
+  if (Graph::Detail::ReadVector<uint64_t>(engines_input) != vector<uint64_t>{Graph::FORMAT_VERSION}) {
+    throw runtime_error("Serialized engines are of another format");
+  }
+  Build(stops_dict, buses_dict, &engines_input);
+  if (engines_input.peek() != istream::traits_type::eof()) {
+    throw runtime_error("Serialized engines do not match the network");
+  }
+}
+
+void TransportRouter::Serialize(ostream& output) const {
+  Graph::Detail::WriteVector(output, vector<uint64_t>{Graph::FORMAT_VERSION});
+  for (const auto& component : components_) {
+    if (!component) {
+      throw logic_error("Updated router can not be serialized");
+    }
+    Graph::Detail::WriteGraphFingerprint(output, component->graph);
+    visit([&output](const auto& engine) { engine->Serialize(output); }, component->router);
+  }
+}
+
+TransportRouter::NetworkGraph TransportRouter::MakeNetwork(const Descriptions::StopsDict& stops_dict,
+                                                           const Descriptions::BusesDict& buses_dict) {
   const size_t vertex_count = stops_dict.size() * 2;
-  vertices_info_.resize(vertex_count);
-  graph_ = BusGraph(vertex_count);
+  NetworkGraph network{
+      .graph = BusGraph(vertex_count),
+      .vertex_stop_names = vector<string>(vertex_count),
+      .vertex_positions = vector<Sphere::Point>(vertex_count),
+  };
+
+  FillGraphWithStops(network, stops_dict, OrderStops(stops_dict, buses_dict));
+  FillGraphWithBuses(network, stops_dict, buses_dict);
+  UpdatePeakMemory(network);
+  ReduceGraph(network);
+  FreezeGraph(network);
+  return network;
+}
+
+void TransportRouter::Build(const Descriptions::StopsDict& stops_dict, const Descriptions::BusesDict& buses_dict,
+                            istream* engines_input) {
+  const NetworkGraph network = MakeNetwork(stops_dict, buses_dict);
+  AddComponents(network, buses_dict, engines_input);
+  UpdatePeakMemory(network);
+}
 
-  FillGraphWithStops(stops_dict);
-  FillGraphWithBuses(stops_dict, buses_dict);
+TransportRouter::PartsMemory TransportRouter::ComputeNetworkMemory(const NetworkGraph& network) {
+  return {
+      .graph = network.graph.GetMemoryUsage() + ComputeMemoryUsage(network.vertex_positions)
+          + ComputeMemoryUsage(network.stops_vertex_ids),
+      .edges_info = ComputeMemoryUsage(network.edges_info) + ComputeMemoryUsage(network.vertex_stop_names),
+      .engines = {},
+  };
+}
 
-  router_ = std::make_unique<Router>(graph_);
+void TransportRouter::UpdatePeakMemory(const NetworkGraph& network) {
+  const PartsMemory network_memory = ComputeNetworkMemory(network);
+  const PartsMemory components_memory = ComputeComponentsMemory();
+  auto update = [](MemoryUsage& peak, const MemoryUsage& usage) {
+    peak = MaxOfEach(peak, usage);
+  };
+  update(peak_memory_.graph, network_memory.graph + components_memory.graph);
+  update(peak_memory_.edges_info, network_memory.edges_info + components_memory.edges_info);
+  update(peak_memory_.engines, components_memory.engines);
 }
 
 TransportRouter::RoutingSettings TransportRouter::MakeRoutingSettings(const Json::Dict& json) {
   return {
       json.at("bus_wait_time").AsInt(),
       json.at("bus_velocity").AsDouble(),
+      [&json] {
+        if (json.count("vertex_order") == 0) {
+          return VertexOrder::Input;
+        }
+        const string& order = json.at("vertex_order").AsString();
+        if (order == "input") {
+          return VertexOrder::Input;
+        } else if (order == "hilbert") {
+          return VertexOrder::Hilbert;
+        } else if (order == "rcm") {
+          return VertexOrder::Rcm;
+        }
+        throw runtime_error("Unknown vertex order: " + order);
+      }(),
+      [&json] {
+        if (json.count("router") == 0) {
+          return RouterEngine::FloydWarshall;
+        }
+        const string& engine = json.at("router").AsString();
+        if (engine == "floyd_warshall") {
+          return RouterEngine::FloydWarshall;
+        } else if (engine == "contraction_hierarchies") {
+          return RouterEngine::ContractionHierarchies;
+        } else if (engine == "hub_labels") {
+          return RouterEngine::HubLabels;
+        } else if (engine == "alt") {
+          return RouterEngine::Alt;
+        }
+        throw runtime_error("Unknown router: " + engine);
+      }(),
+      json.count("alt_landmark_count") ? static_cast<size_t>(json.at("alt_landmark_count").AsInt()) : 8,
   };
 }
 
-void TransportRouter::FillGraphWithStops(const Descriptions::StopsDict& stops_dict) {
+vector<const string*> TransportRouter::OrderStops(const Descriptions::StopsDict& stops_dict,
+                                                  const Descriptions::BusesDict& buses_dict) const {
+  vector<const string*> stop_names;
+  stop_names.reserve(stops_dict.size());
+  for (const auto& [stop_name, _] : stops_dict) {
+    stop_names.push_back(&stop_name);
+  }
+  if (stop_names.empty()) {
+    return stop_names;
+  }
+  switch (routing_settings_.vertex_order) {
+    case VertexOrder::Input:
+      break;
+
+    case VertexOrder::Hilbert: {
+      double min_lat = 90, max_lat = -90, min_lon = 180, max_lon = -180;
+      for (const auto& [_, stop] : stops_dict) {
+        min_lat = min(min_lat, stop->position.latitude);
+        max_lat = max(max_lat, stop->position.latitude);
+        min_lon = min(min_lon, stop->position.longitude);
+        max_lon = max(max_lon, stop->position.longitude);
+      }
+      auto to_cell = [](double value, double min_value, double max_value) {
+        const double span = max_value - min_value;
+        return span > 0 ? static_cast<uint32_t>((value - min_value) / span * 65535) : 0u;
+      };
+      unordered_map<const string*, uint64_t> hilbert_indices;
+      for (const string* stop_name : stop_names) {
+        const Sphere::Point position = stops_dict.at(*stop_name)->position;
+        hilbert_indices[stop_name] = ComputeHilbertIndex(
+            to_cell(position.longitude, min_lon, max_lon),
+            to_cell(position.latitude, min_lat, max_lat));
+      }
+      sort(begin(stop_names), end(stop_names), [&](const string* lhs, const string* rhs) {
+        return tie(hilbert_indices[lhs], *lhs) < tie(hilbert_indices[rhs], *rhs);
+      });
+      break;
+    }
+
+    case VertexOrder::Rcm: {
+      sort(begin(stop_names), end(stop_names), [](const string* lhs, const string* rhs) { return *lhs < *rhs; });
+      unordered_map<string_view, size_t> stop_idx_by_name;
+      for (size_t stop_idx = 0; stop_idx < stop_names.size(); ++stop_idx) {
+        stop_idx_by_name[*stop_names[stop_idx]] = stop_idx;
+      }
+      vector<vector<size_t>> neighbours(stop_names.size());
+      for (const auto& [_, bus] : buses_dict) {
+        for (size_t idx = 0; idx + 1 < bus->stops.size(); ++idx) {
+          const size_t lhs = stop_idx_by_name.at(bus->stops[idx]);
+          const size_t rhs = stop_idx_by_name.at(bus->stops[idx + 1]);
+          if (lhs != rhs) {
+            neighbours[lhs].push_back(rhs);
+            neighbours[rhs].push_back(lhs);
+          }
+        }
+      }
+      for (auto& stop_neighbours : neighbours) {
+        sort(begin(stop_neighbours), end(stop_neighbours));
+        stop_neighbours.erase(unique(begin(stop_neighbours), end(stop_neighbours)), end(stop_neighbours));
+      }
+      auto by_degree = [&neighbours](size_t lhs, size_t rhs) {
+        return pair{neighbours[lhs].size(), lhs} < pair{neighbours[rhs].size(), rhs};
+      };
+      for (auto& stop_neighbours : neighbours) {
+        sort(begin(stop_neighbours), end(stop_neighbours), by_degree);
+      }
+
+      // Cuthill-McKee: BFS from a vertex of minimal degree in every component, then reversed
+      vector<size_t> roots(stop_names.size());
+      iota(begin(roots), end(roots), 0);
+      sort(begin(roots), end(roots), by_degree);
+      vector<bool> is_visited(stop_names.size(), false);
+      vector<size_t> order;
+      order.reserve(stop_names.size());
+      for (const size_t root : roots) {
+        if (is_visited[root]) {
+          continue;
+        }
+        is_visited[root] = true;
+        order.push_back(root);
+        for (size_t queue_idx = order.size() - 1; queue_idx < order.size(); ++queue_idx) {
+          for (const size_t neighbour : neighbours[order[queue_idx]]) {
+            if (!is_visited[neighbour]) {
+              is_visited[neighbour] = true;
+              order.push_back(neighbour);
+            }
+          }
+        }
+      }
+
+      vector<const string*> ordered_stop_names;
+      ordered_stop_names.reserve(stop_names.size());
+      for (auto it = rbegin(order); it != rend(order); ++it) {
+        ordered_stop_names.push_back(stop_names[*it]);
+      }
+      stop_names = move(ordered_stop_names);
+      break;
+    }
+  }
+  return stop_names;
+}
+
+void TransportRouter::FillGraphWithStops(NetworkGraph& network,
+                                         const Descriptions::StopsDict& stops_dict,
+                                         const vector<const string*>& stop_names) const {
+  TRACE_SCOPE("TransportRouter::FillGraphWithStops");
   Graph::VertexId vertex_id = 0;
 
-  for (const auto& [stop_name, _] : stops_dict) {
-    auto& vertex_ids = stops_vertex_ids_[stop_name];
+  for (const string* stop_name_ptr : stop_names) {
+    const string& stop_name = *stop_name_ptr;
+    auto& vertex_ids = network.stops_vertex_ids[stop_name];
     vertex_ids.in = vertex_id++;
     vertex_ids.out = vertex_id++;
-    vertices_info_[vertex_ids.in] = {stop_name};
-    vertices_info_[vertex_ids.out] = {stop_name};
+    network.vertex_stop_names[vertex_ids.in] = stop_name;
+    network.vertex_stop_names[vertex_ids.out] = stop_name;
+    network.vertex_positions[vertex_ids.in] = network.vertex_positions[vertex_ids.out] = stops_dict.at(stop_name)->position;
 
-    edges_info_.push_back(WaitEdgeInfo{});
-    const Graph::EdgeId edge_id = graph_.AddEdge({
+    network.edges_info.push_back(WaitEdgeInfo{});
+    const Graph::EdgeId edge_id = network.graph.AddEdge({
         vertex_ids.out,
         vertex_ids.in,
         static_cast<double>(routing_settings_.bus_wait_time)
     });
-    assert(edge_id == edges_info_.size() - 1);
+    assert(edge_id == network.edges_info.size() - 1);
   }
 
-  assert(vertex_id == graph_.GetVertexCount());
+  assert(vertex_id == network.graph.GetVertexCount());
 }
 
-void TransportRouter::FillGraphWithBuses(const Descriptions::StopsDict& stops_dict,
-                                         const Descriptions::BusesDict& buses_dict) {
+void TransportRouter::FillGraphWithBuses(NetworkGraph& network,
+                                         const Descriptions::StopsDict& stops_dict,
+                                         const Descriptions::BusesDict& buses_dict) const {
+  TRACE_SCOPE("TransportRouter::FillGraphWithBuses");
   for (const auto& [_, bus_item] : buses_dict) {
     const auto& bus = *bus_item;
-    const size_t stop_count = bus.stops.size();
+    const auto route = bus.GetRoute();
+    const size_t stop_count = route.size();
     if (stop_count <= 1) {
       continue;
     }
-    auto compute_distance_from = [&stops_dict, &bus](size_t lhs_idx) {
-      return Descriptions::ComputeStopsDistance(*stops_dict.at(bus.stops[lhs_idx]), *stops_dict.at(bus.stops[lhs_idx + 1]));
+    // road distance from the first stop of the route
+    vector<int> route_distances = {0};
+    route_distances.reserve(stop_count);
+    for (size_t stop_idx = 0; stop_idx + 1 < stop_count; ++stop_idx) {
+      const int distance = Descriptions::ComputeStopsDistance(*stops_dict.at(route[stop_idx]), *stops_dict.at(route[stop_idx + 1]));
+      route_distances.push_back(route_distances.back() + distance);
+      const double geo_distance = Sphere::Distance(stops_dict.at(route[stop_idx])->position,
+                                                   stops_dict.at(route[stop_idx + 1])->position);
+      if (geo_distance > 0) {
+        network.min_minutes_per_geo_meter = min(
+            network.min_minutes_per_geo_meter,
+            distance / geo_distance / (routing_settings_.bus_velocity * 1000.0 / 60)
+        );
+      }
+    }
+    // A ride of a non-roundtrip bus through its far end stop to any stop but the boarding one
+    // is longer than the ride between the same stops on one leg, so ReduceGraph would drop it anyway
+    const size_t turn_idx = route.GetTurnIdx();
+    auto is_dominated = [&](size_t start_stop_idx, size_t finish_stop_idx) {
+      if (bus.is_roundtrip || start_stop_idx >= turn_idx || finish_stop_idx <= turn_idx) {
+        return false;
+      }
+      const size_t mirror_stop_idx = 2 * turn_idx - finish_stop_idx;
+      if (mirror_stop_idx > start_stop_idx) {
+        return route_distances[finish_stop_idx] > route_distances[mirror_stop_idx];
+      }
+      if (mirror_stop_idx < start_stop_idx) {
+        return route_distances[2 * turn_idx - start_stop_idx] > route_distances[start_stop_idx];
+      }
+      return false;
     };
     for (size_t start_stop_idx = 0; start_stop_idx + 1 < stop_count; ++start_stop_idx) {
-      const Graph::VertexId start_vertex = stops_vertex_ids_[bus.stops[start_stop_idx]].in;
-      int total_distance = 0;
+      const Graph::VertexId start_vertex = network.stops_vertex_ids[route[start_stop_idx]].in;
       for (size_t finish_stop_idx = start_stop_idx + 1; finish_stop_idx < stop_count; ++finish_stop_idx) {
-        total_distance += compute_distance_from(finish_stop_idx - 1);
-        edges_info_.push_back(BusEdgeInfo{
+        if (is_dominated(start_stop_idx, finish_stop_idx)) {
+          continue;
+        }
+        const int total_distance = route_distances[finish_stop_idx] - route_distances[start_stop_idx];
+        network.edges_info.push_back(BusEdgeInfo{
             .bus_name = bus.name,
             .span_count = finish_stop_idx - start_stop_idx,
+            .start_stop_idx = start_stop_idx,
         });
-        const Graph::EdgeId edge_id = graph_.AddEdge({
+        const Graph::EdgeId edge_id = network.graph.AddEdge({
             start_vertex,
-            stops_vertex_ids_[bus.stops[finish_stop_idx]].out,
+            network.stops_vertex_ids[route[finish_stop_idx]].out,
             total_distance * 1.0 / (routing_settings_.bus_velocity * 1000.0 / 60)  // m / (km/h * 1000 / 60) = min
         });
-        assert(edge_id == edges_info_.size() - 1);
+        assert(edge_id == network.edges_info.size() - 1);
+      }
+    }
+  }
+}
+
+void TransportRouter::ReduceGraph(NetworkGraph& network) {
+  auto reduced = Graph::ReduceGraph(network.graph);
+
+  vector<EdgeInfo> edges_info;
+  edges_info.reserve(reduced.original_edge_ids.size());
+  for (const Graph::EdgeId edge_id : reduced.original_edge_ids) {
+    edges_info.push_back(move(network.edges_info[edge_id]));
+  }
+
+  network.graph = move(reduced.graph);
+  network.edges_info = move(edges_info);
+}
+
+void TransportRouter::FreezeGraph(NetworkGraph& network) {
+  const auto old_edge_ids = network.graph.Freeze();
+
+  vector<EdgeInfo> edges_info;
+  edges_info.reserve(old_edge_ids.size());
+  for (const Graph::EdgeId old_edge_id : old_edge_ids) {
+    edges_info.push_back(move(network.edges_info[old_edge_id]));
+  }
+  network.edges_info = move(edges_info);
+}
+
+void TransportRouter::AddComponents(const NetworkGraph& network, const Descriptions::BusesDict& buses_dict,
+                                    istream* engines_input, const unordered_set<size_t>& replaced_component_idxs) {
+  auto split = Graph::SplitIntoComponents(network.graph);
+  const size_t component_count = split.components.size();
+
+  // a replaced component is kept if all stops of a new one come from it, and only they do
+  static const size_t NO_COMPONENT = numeric_limits<size_t>::max();
+  vector<size_t> kept_component_idxs(component_count, NO_COMPONENT);
+  vector<size_t> stop_counts(component_count, 0);
+  vector<bool> is_mixed(component_count, false);
+  for (const auto& [stop_name, vertex_ids] : network.stops_vertex_ids) {
+    const size_t split_idx = split.vertex_positions[vertex_ids.out].component_idx;
+    const auto location_it = stop_locations_.find(stop_name);
+    const size_t old_component_idx = location_it != stop_locations_.end()
+        && replaced_component_idxs.count(location_it->second.component_idx) > 0
+        ? location_it->second.component_idx : NO_COMPONENT;
+    if (stop_counts[split_idx]++ == 0) {
+      kept_component_idxs[split_idx] = old_component_idx;
+    } else if (kept_component_idxs[split_idx] != old_component_idx) {
+      is_mixed[split_idx] = true;
+    }
+  }
+  unordered_set<size_t> dropped_component_idxs = replaced_component_idxs;
+  for (size_t split_idx = 0; split_idx < component_count; ++split_idx) {
+    const size_t component_idx = kept_component_idxs[split_idx];
+    if (is_mixed[split_idx] || component_idx == NO_COMPONENT
+        || components_[component_idx]->graph.GetVertexCount() != split.components[split_idx].graph.GetVertexCount()) {
+      kept_component_idxs[split_idx] = NO_COMPONENT;
+    } else {
+      dropped_component_idxs.erase(component_idx);
+    }
+  }
+  for (const size_t component_idx : dropped_component_idxs) {
+    components_[component_idx].reset();
+    free_component_idxs_.push_back(component_idx);
+  }
+
+  // slots of the components and their vertex ids by vertex id in the split
+  vector<size_t> component_idxs(component_count);
+  vector<vector<Graph::VertexId>> vertex_ids(component_count);
+  for (size_t split_idx = 0; split_idx < component_count; ++split_idx) {
+    const size_t vertex_count = split.components[split_idx].graph.GetVertexCount();
+    if (kept_component_idxs[split_idx] != NO_COMPONENT) {
+      component_idxs[split_idx] = kept_component_idxs[split_idx];
+      vertex_ids[split_idx].resize(vertex_count);
+    } else {
+      component_idxs[split_idx] = AllocateComponentSlot();
+      components_[component_idxs[split_idx]] = make_unique<Component>();
+      vertex_ids[split_idx].resize(vertex_count);
+      iota(begin(vertex_ids[split_idx]), end(vertex_ids[split_idx]), 0);
+    }
+  }
+  for (const auto& [stop_name, network_vertex_ids] : network.stops_vertex_ids) {
+    const auto& position_in = split.vertex_positions[network_vertex_ids.in];
+    const auto& position_out = split.vertex_positions[network_vertex_ids.out];
+    const size_t split_idx = position_out.component_idx;
+    auto& component_vertex_ids = vertex_ids[split_idx];
+    if (kept_component_idxs[split_idx] != NO_COMPONENT) {
+      const StopLocation& location = stop_locations_.at(stop_name);
+      component_vertex_ids[position_in.vertex_id] = location.in;
+      component_vertex_ids[position_out.vertex_id] = location.out;
+    }
+    stop_locations_[stop_name] = {
+        component_idxs[split_idx], component_vertex_ids[position_in.vertex_id], component_vertex_ids[position_out.vertex_id]
+    };
+  }
+
+  vector<BusGraph> old_graphs(component_count);
+  for (size_t split_idx = 0; split_idx < component_count; ++split_idx) {
+    auto& graph_component = split.components[split_idx];
+    Component& component = *components_[component_idxs[split_idx]];
+    const bool is_kept = kept_component_idxs[split_idx] != NO_COMPONENT;
+    vector<Graph::EdgeId> original_edge_ids = move(graph_component.original_edge_ids);
+    if (is_kept) {
+      // renumbered to the vertex ids of the replaced component, then packed anew
+      const auto& component_vertex_ids = vertex_ids[split_idx];
+      BusGraph graph(graph_component.graph.GetVertexCount());
+      for (Graph::EdgeId edge_id = 0; edge_id < graph_component.graph.GetEdgeCount(); ++edge_id) {
+        const auto& edge = graph_component.graph.GetEdge(edge_id);
+        graph.AddEdge({component_vertex_ids[edge.from], component_vertex_ids[edge.to], edge.weight});
+      }
+      vector<Graph::EdgeId> packed_original_edge_ids;
+      packed_original_edge_ids.reserve(original_edge_ids.size());
+      for (const Graph::EdgeId edge_id : graph.Freeze()) {
+        packed_original_edge_ids.push_back(original_edge_ids[edge_id]);
+      }
+      original_edge_ids = move(packed_original_edge_ids);
+      old_graphs[split_idx] = move(component.graph);
+      component.graph = move(graph);
+    } else {
+      component.graph = move(graph_component.graph);
+    }
+    component.vertex_stop_names.resize(component.graph.GetVertexCount());
+    component.vertex_positions.resize(component.graph.GetVertexCount());
+    component.min_minutes_per_geo_meter = network.min_minutes_per_geo_meter;
+    component.edges_info.clear();
+    component.edges_info.reserve(original_edge_ids.size());
+    for (const Graph::EdgeId network_edge_id : original_edge_ids) {
+      component.edges_info.push_back(network.edges_info[network_edge_id]);
+    }
+    component.bus_names.clear();
+  }
+
+  for (Graph::VertexId vertex_id = 0; vertex_id < split.vertex_positions.size(); ++vertex_id) {
+    const auto& position = split.vertex_positions[vertex_id];
+    auto& component = *components_[component_idxs[position.component_idx]];
+    const Graph::VertexId component_vertex_id = vertex_ids[position.component_idx][position.vertex_id];
+    component.vertex_stop_names[component_vertex_id] = network.vertex_stop_names[vertex_id];
+    component.vertex_positions[component_vertex_id] = network.vertex_positions[vertex_id];
+  }
+  for (const auto& [bus_name, bus] : buses_dict) {
+    if (!bus->stops.empty()) {
+      components_[stop_locations_.at(bus->stops.front()).component_idx]->bus_names.push_back(bus_name);
+    }
+  }
+
+  for (size_t split_idx = 0; split_idx < component_count; ++split_idx) {
+    Component& component = *components_[component_idxs[split_idx]];
+    if (kept_component_idxs[split_idx] != NO_COMPONENT) {
+      UpdateRouter(component, old_graphs[split_idx]);
+    } else {
+      component.router = MakeRouter(component, engines_input);
+    }
+  }
+}
+
+void TransportRouter::UpdateRouter(Component& component, const BusGraph& old_graph) const {
+  if (auto* router = get_if<unique_ptr<Router>>(&component.router)) {
+    TRACE_SCOPE("TransportRouter::UpdateRouter");
+    (*router)->Update(old_graph);  // refers to component.graph, replaced in place
+  } else {
+    component.router = MakeRouter(component, nullptr);
+  }
+}
+
+size_t TransportRouter::AllocateComponentSlot() {
+  if (free_component_idxs_.empty()) {
+    components_.emplace_back();
+    return components_.size() - 1;
+  }
+  const size_t component_idx = free_component_idxs_.back();
+  free_component_idxs_.pop_back();
+  return component_idx;
+}
+
+TransportRouter::RouterEngineHolder TransportRouter::MakeRouter(const Component& component, istream* engines_input) const {
+  TRACE_SCOPE(engines_input ? "TransportRouter::MakeRouter (load)" : "TransportRouter::MakeRouter");
+  if (engines_input) {
+    Graph::Detail::CheckGraphFingerprint(*engines_input, component.graph);
+  }
+  const BusGraph& graph = component.graph;
+  switch (routing_settings_.router_engine) {
+    case RouterEngine::FloydWarshall:
+      return engines_input
+          ? make_unique<Router>(Router::Deserialize(graph, *engines_input))
+          : make_unique<Router>(graph);
+    case RouterEngine::ContractionHierarchies:
+      return engines_input
+          ? make_unique<ContractionHierarchy>(ContractionHierarchy::Deserialize(graph, *engines_input))
+          : make_unique<ContractionHierarchy>(graph);
+    case RouterEngine::HubLabels:
+      return engines_input
+          ? make_unique<HubLabels>(HubLabels::Deserialize(graph, *engines_input))
+          : make_unique<HubLabels>(graph);
+    case RouterEngine::Alt: {
+      AltRouter::LowerBound geo_bound;
+      if (isfinite(component.min_minutes_per_geo_meter)) {
+        // slightly loosened so that rounding never lifts it above the distance
+        geo_bound = [&component, factor = component.min_minutes_per_geo_meter * (1 - 1e-9)](Graph::VertexId from, Graph::VertexId to) {
+          return Sphere::Distance(component.vertex_positions[from], component.vertex_positions[to]) * factor;
+        };
       }
+      return engines_input
+          ? make_unique<AltRouter>(AltRouter::Deserialize(graph, *engines_input, move(geo_bound)))
+          : make_unique<AltRouter>(graph, routing_settings_.alt_landmark_count, move(geo_bound));
+    }
+  }
+  throw logic_error("Unexpected router engine");
+}
+
+void TransportRouter::Update(const Descriptions::StopsDict& stops_dict,
+                             const Descriptions::BusesDict& buses_dict,
+                             const vector<string>& changed_stop_names,
+                             const vector<string>& changed_bus_names) {
+  TRACE_SCOPE("TransportRouter::Update");
+  unordered_set<string> stop_names(begin(changed_stop_names), end(changed_stop_names));
+  unordered_set<string> bus_names(begin(changed_bus_names), end(changed_bus_names));
+  unordered_set<size_t> replaced_component_idxs;
+  for (const string& stop_name : changed_stop_names) {
+    const auto location_it = stop_locations_.find(stop_name);
+    if (location_it == stop_locations_.end()) {
+      continue;  // new stop
+    }
+    if (!replaced_component_idxs.insert(location_it->second.component_idx).second) {
+      continue;
     }
+    const Component& component = *components_[location_it->second.component_idx];
+    stop_names.insert(begin(component.vertex_stop_names), end(component.vertex_stop_names));
+    bus_names.insert(begin(component.bus_names), end(component.bus_names));
   }
+
+  Descriptions::StopsDict affected_stops_dict;
+  for (const string& stop_name : stop_names) {
+    if (auto it = stops_dict.find(stop_name); it != stops_dict.end()) {
+      affected_stops_dict.insert(*it);
+    }
+  }
+  Descriptions::BusesDict affected_buses_dict;
+  for (const string& bus_name : bus_names) {
+    if (auto it = buses_dict.find(bus_name); it != buses_dict.end()) {
+      affected_buses_dict.insert(*it);
+    }
+  }
+  const NetworkGraph network = MakeNetwork(affected_stops_dict, affected_buses_dict);
+  AddComponents(network, affected_buses_dict, nullptr, replaced_component_idxs);
+  UpdatePeakMemory(network);
+  for (const string& stop_name : stop_names) {
+    if (stops_dict.count(stop_name) == 0) {
+      stop_locations_.erase(stop_name);
+    }
+  }
+}
+
+const TransportRouter::Component* TransportRouter::FindComponent(const string& stop_from, const string& stop_to) const {
+  const auto location_from_it = stop_locations_.find(stop_from);
+  const auto location_to_it = stop_locations_.find(stop_to);
+  if (location_from_it == stop_locations_.end() || location_to_it == stop_locations_.end()
+      || location_from_it->second.component_idx != location_to_it->second.component_idx) {
+    return nullptr;
+  }
+  return components_[location_from_it->second.component_idx].get();
 }
 
 optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(const string& stop_from, const string& stop_to) const {
-  const Graph::VertexId vertex_from = stops_vertex_ids_.at(stop_from).out;
-  const Graph::VertexId vertex_to = stops_vertex_ids_.at(stop_to).out;
-  const auto route = router_->BuildRoute(vertex_from, vertex_to);
+  const Component* component = FindComponent(stop_from, stop_to);
+  if (!component) {
+    return nullopt;
+  }
+  return visit([&](const auto& router) {
+    return FindRoute(*router, *component, stop_locations_.at(stop_from).out, stop_locations_.at(stop_to).out);
+  }, component->router);
+}
+
+optional<double> TransportRouter::FindRouteTime(const string& stop_from, const string& stop_to) const {
+  const Component* component = FindComponent(stop_from, stop_to);
+  if (!component) {
+    return nullopt;
+  }
+  const Graph::VertexId vertex_from = stop_locations_.at(stop_from).out;
+  const Graph::VertexId vertex_to = stop_locations_.at(stop_to).out;
+  return visit([&](const auto& router) -> optional<double> {
+    if constexpr (is_same_v<decay_t<decltype(*router)>, HubLabels>) {
+      return router->GetDistance(vertex_from, vertex_to);
+    } else {
+      const auto route = router->BuildRoute(vertex_from, vertex_to);
+      if (!route) {
+        return nullopt;
+      }
+      router->ReleaseRoute(route->id);
+      return route->weight;
+    }
+  }, component->router);
+}
+
+TransportRouter::Stats TransportRouter::GetStats() const {
+  static const unordered_map<RouterEngine, string> engine_names = {
+      {RouterEngine::FloydWarshall, "floyd_warshall"},
+      {RouterEngine::ContractionHierarchies, "contraction_hierarchies"},
+      {RouterEngine::HubLabels, "hub_labels"},
+      {RouterEngine::Alt, "alt"},
+  };
+  Stats stats{
+      .engine = engine_names.at(routing_settings_.router_engine),
+      .vertex_count = 0,
+      .edge_count = 0,
+      .component_count = 0,
+      .engine_memory = 0,
+  };
+  for (const auto& component : components_) {
+    if (!component) {
+      continue;
+    }
+    stats.vertex_count += component->graph.GetVertexCount();
+    stats.edge_count += component->graph.GetEdgeCount();
+    ++stats.component_count;
+    stats.engine_memory += visit([](const auto& engine) { return engine->GetMemoryUsage().estimated_bytes; }, component->router);
+  }
+  return stats;
+}
+
+TransportRouter::PartsMemory TransportRouter::ComputeComponentsMemory() const {
+  PartsMemory memory = {
+      .graph = ComputeMemoryUsage(stop_locations_) + ComputeArrayUsage<unique_ptr<Component>>(components_.capacity())
+          + ComputeMemoryUsage(free_component_idxs_),
+  };
+  for (const auto& component : components_) {
+    if (!component) {
+      continue;
+    }
+    memory.graph += ComputeArrayUsage<Component>(1) + component->graph.GetMemoryUsage()
+        + ComputeMemoryUsage(component->vertex_positions);
+    memory.edges_info += ComputeMemoryUsage(component->edges_info) + ComputeMemoryUsage(component->vertex_stop_names) + ComputeMemoryUsage(component->bus_names);
+    memory.engines += visit([](const auto& engine) { return ComputeMemoryUsage(engine); }, component->router);
+  }
+  return memory;
+}
+
+vector<SubsystemMemory> TransportRouter::GetMemoryStats() const {
+  const PartsMemory memory = ComputeComponentsMemory();
+  return {
+      {"router_graph", memory.graph, MaxOfEach(memory.graph, peak_memory_.graph)},
+      {"router_edges_info", memory.edges_info, MaxOfEach(memory.edges_info, peak_memory_.edges_info)},
+      {"router_engines", memory.engines, MaxOfEach(memory.engines, peak_memory_.engines)},
+  };
+}
+
+template <typename Engine>
+optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(Engine& router, const Component& component,
+                                                                Graph::VertexId vertex_from, Graph::VertexId vertex_to) const {
+  const auto route = router.BuildRoute(vertex_from, vertex_to);
   if (!route) {
     return nullopt;
   }
@@ -89,20 +694,21 @@ optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(const string& st
   RouteInfo route_info = {.total_time = route->weight};
   route_info.items.reserve(route->edge_count);
   for (size_t edge_idx = 0; edge_idx < route->edge_count; ++edge_idx) {
-    const Graph::EdgeId edge_id = router_->GetRouteEdge(route->id, edge_idx);
-    const auto& edge = graph_.GetEdge(edge_id);
-    const auto& edge_info = edges_info_[edge_id];
+    const Graph::EdgeId edge_id = router.GetRouteEdge(route->id, edge_idx);
+    const auto& edge = component.graph.GetEdge(edge_id);
+    const auto& edge_info = component.edges_info[edge_id];
     if (holds_alternative<BusEdgeInfo>(edge_info)) {
       const BusEdgeInfo& bus_edge_info = get<BusEdgeInfo>(edge_info);
       route_info.items.push_back(RouteInfo::BusItem{
           .bus_name = bus_edge_info.bus_name,
           .time = edge.weight,
           .span_count = bus_edge_info.span_count,
+          .start_stop_idx = bus_edge_info.start_stop_idx,
       });
     } else {
       const Graph::VertexId vertex_id = edge.from;
       route_info.items.push_back(RouteInfo::WaitItem{
-          .stop_name = vertices_info_[vertex_id].stop_name,
+          .stop_name = component.vertex_stop_names[vertex_id],
           .time = edge.weight,
       });
     }
@@ -110,6 +716,6 @@ optional<TransportRouter::RouteInfo> TransportRouter::FindRoute(const string& st
 
   // Releasing in destructor of some proxy object would be better,
   // but we do not expect exceptions in normal workflow
-  router_->ReleaseRoute(route->id);
+  router.ReleaseRoute(route->id);
   return route_info;
 }
@@ -1,35 +1,74 @@
 #pragma once
 
+#include "alt_router.h"
+#include "contraction_hierarchy.h"
 #include "descriptions.h"
 #include "graph.h"
+#include "graph_components.h"
+#include "graph_reduction.h"
+#include "hub_labels.h"
 #include "json.h"
+#include "memory_usage.h"
 #include "router.h"
+#include "sphere.h"
 
+#include <istream>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <variant>
 #include <vector>
 
 class TransportRouter {
 private:
   using BusGraph = Graph::DirectedWeightedGraph<double>;
   using Router = Graph::Router<double>;
+  using ContractionHierarchy = Graph::ContractionHierarchy<double>;
+  using HubLabels = Graph::HubLabels<double>;
+  using AltRouter = Graph::AltRouter<double>;
+  // all engines share the BuildRoute/GetRouteEdge/ReleaseRoute API
+  using RouterEngineHolder = std::variant<
+      std::unique_ptr<Router>,
+      std::unique_ptr<ContractionHierarchy>,
+      std::unique_ptr<HubLabels>,
+      std::unique_ptr<AltRouter>
+  >;
 
 public:
   TransportRouter(const Descriptions::StopsDict& stops_dict,
                   const Descriptions::BusesDict& buses_dict,
                   const Json::Dict& routing_settings_json);
+  // Restores the engines saved by Serialize for the same stops, buses and settings
+  // instead of precomputing them
+  TransportRouter(const Descriptions::StopsDict& stops_dict,
+                  const Descriptions::BusesDict& buses_dict,
+                  const Json::Dict& routing_settings_json,
+                  std::istream& engines_input);
+
+  // Precomputed engines of all components; not available after Update
+  void Serialize(std::ostream& output) const;
 
   struct RouteInfo {
     double total_time;
 
+    // Timestamps, in minutes since midnight, are known for routes over timetables only
     struct BusItem {
       std::string bus_name;
       double time;
       size_t span_count;
+      size_t start_stop_idx;  // position in the bus route where the ride begins
+      std::optional<double> departure_time;
+      std::optional<double> arrival_time;
     };
     struct WaitItem {
       std::string stop_name;
       double time;
+      std::optional<double> arrival_time;  // at the stop, when the wait begins
+      std::optional<double> departure_time;  // of the bus, when the wait ends
     };
 
     using Item = std::variant<BusItem, WaitItem>;
@@ -37,39 +76,153 @@ public:
   };
 
   std::optional<RouteInfo> FindRoute(const std::string& stop_from, const std::string& stop_to) const;
+  // Without the items: cheaper for engines that know distances without restoring routes
+  std::optional<double> FindRouteTime(const std::string& stop_from, const std::string& stop_to) const;
+
+  struct Stats {
+    std::string engine;
+    size_t vertex_count;
+    size_t edge_count;
+    size_t component_count;
+    size_t engine_memory;  // routing tables, shortcuts or labels, in bytes
+  };
+  Stats GetStats() const;
+
+  // Graphs, descriptions of their edges and engines of all components;
+  // the peak, of bytes and of allocations each, also counts the network graph that builds and updates
+  // make before the components
+  std::vector<SubsystemMemory> GetMemoryStats() const;
+
+  // Applies a change of the network. The dicts describe the network after the change;
+  // changed stops are the stops added, removed or modified, together with all stops of the buses
+  // added, removed or modified, before and after the change. Only the components touched are rebuilt;
+  // a component left with the same stops keeps its engine, and Floyd-Warshall recomputes only
+  // the rows of its table the change can reach.
+  void Update(const Descriptions::StopsDict& stops_dict,
+              const Descriptions::BusesDict& buses_dict,
+              const std::vector<std::string>& changed_stop_names,
+              const std::vector<std::string>& changed_bus_names);
 
 private:
+  // How stops are numbered in the graph; the choice affects only memory locality
+  enum class VertexOrder {
+    Input,  // StopsDict iteration order
+    Hilbert,  // along a Hilbert curve over stop coordinates
+    Rcm,  // reverse Cuthill-McKee over stops adjacent in bus routes
+  };
+
+  enum class RouterEngine {
+    FloydWarshall,  // all-pairs table: fastest queries, quadratic memory
+    ContractionHierarchies,  // shortcuts over the graph: near-linear memory for large networks
+    HubLabels,  // distances to and from hubs: fastest total_time queries
+    Alt,  // bidirectional A* with geographic and landmark bounds: no all-pairs precompute
+  };
+
   struct RoutingSettings {
     int bus_wait_time;  // in minutes
     double bus_velocity;  // km/h
+    VertexOrder vertex_order;
+    RouterEngine router_engine;
+    size_t alt_landmark_count;
   };
 
   static RoutingSettings MakeRoutingSettings(const Json::Dict& json);
 
-  void FillGraphWithStops(const Descriptions::StopsDict& stops_dict);
-
-  void FillGraphWithBuses(const Descriptions::StopsDict& stops_dict,
-                          const Descriptions::BusesDict& buses_dict);
-
   struct StopVertexIds {
     Graph::VertexId in;
     Graph::VertexId out;
   };
-  struct VertexInfo {
-    std::string stop_name;
-  };
 
   struct BusEdgeInfo {
     std::string bus_name;
     size_t span_count;
+    size_t start_stop_idx;
+
+    MemoryUsage GetMemoryUsage() const { return ComputeMemoryUsage(bus_name); }
   };
   struct WaitEdgeInfo {};
   using EdgeInfo = std::variant<BusEdgeInfo, WaitEdgeInfo>;
 
+  // Graph of the whole network, or of its part touched by an update, before the split into components
+  struct NetworkGraph {
+    BusGraph graph;
+    std::vector<std::string> vertex_stop_names;  // by vertex id
+    std::vector<Sphere::Point> vertex_positions;  // by vertex id
+    // by edge id; of the rides ReduceGraph merges into one edge, the first one of minimal time,
+    // which the router would report anyway
+    std::vector<EdgeInfo> edges_info;
+    std::unordered_map<std::string, StopVertexIds> stops_vertex_ids;
+    // a ride takes at least this long per meter of great-circle distance; infinite without rides
+    double min_minutes_per_geo_meter = std::numeric_limits<double>::infinity();
+  };
+
+  // Weakly connected part of the network with its own router
+  struct Component {
+    BusGraph graph;
+    std::vector<std::string> vertex_stop_names;
+    std::vector<Sphere::Point> vertex_positions;
+    std::vector<EdgeInfo> edges_info;
+    std::vector<std::string> bus_names;
+    double min_minutes_per_geo_meter;
+    RouterEngineHolder router;
+  };
+
+  struct PartsMemory {
+    MemoryUsage graph;
+    MemoryUsage edges_info;
+    MemoryUsage engines;
+  };
+  PartsMemory ComputeComponentsMemory() const;
+  static PartsMemory ComputeNetworkMemory(const NetworkGraph& network);
+  // Keeps the largest memory of every part, with the network graph being built alive
+  void UpdatePeakMemory(const NetworkGraph& network);
+
+  struct StopLocation {
+    size_t component_idx;
+    Graph::VertexId in;
+    Graph::VertexId out;  // in the component graph; routes start and end at out vertices
+  };
+
+  std::vector<const std::string*> OrderStops(const Descriptions::StopsDict& stops_dict,
+                                             const Descriptions::BusesDict& buses_dict) const;
+
+  void FillGraphWithStops(NetworkGraph& network,
+                          const Descriptions::StopsDict& stops_dict,
+                          const std::vector<const std::string*>& stop_names) const;
+
+  void FillGraphWithBuses(NetworkGraph& network,
+                          const Descriptions::StopsDict& stops_dict,
+                          const Descriptions::BusesDict& buses_dict) const;
+
+  // Drops parallel and dominated edges before the router precompute
+  static void ReduceGraph(NetworkGraph& network);
+  // Packs the final graph into CSR order for cache-friendly traversals
+  static void FreezeGraph(NetworkGraph& network);
+  // One router per weakly connected component: no table cells for unreachable pairs.
+  // A component over the same stops as one of the replaced components takes its place and vertex ids
+  // and updates its engine; the other replaced components are dropped, and their slots are reused
+  void AddComponents(const NetworkGraph& network, const Descriptions::BusesDict& buses_dict,
+                     std::istream* engines_input, const std::unordered_set<size_t>& replaced_component_idxs = {});
+  // Updates the engine of a component which graph has been replaced by one over the same vertices
+  void UpdateRouter(Component& component, const BusGraph& old_graph) const;
+  size_t AllocateComponentSlot();
+
+  // Graph of the stops and buses given, reduced and frozen
+  NetworkGraph MakeNetwork(const Descriptions::StopsDict& stops_dict, const Descriptions::BusesDict& buses_dict);
+  void Build(const Descriptions::StopsDict& stops_dict, const Descriptions::BusesDict& buses_dict,
+             std::istream* engines_input = nullptr);
+  RouterEngineHolder MakeRouter(const Component& component, std::istream* engines_input) const;
+
+  // Null unless both stops are known, not removed by an update, and in the same component
+  const Component* FindComponent(const std::string& stop_from, const std::string& stop_to) const;
+
+  template <typename Engine>
+  std::optional<RouteInfo> FindRoute(Engine& router, const Component& component,
+                                     Graph::VertexId vertex_from, Graph::VertexId vertex_to) const;
+
   RoutingSettings routing_settings_;
-  BusGraph graph_;
-  std::unique_ptr<Router> router_;
-  std::unordered_map<std::string, StopVertexIds> stops_vertex_ids_;
-  std::vector<VertexInfo> vertices_info_;
-  std::vector<EdgeInfo> edges_info_;
+  std::vector<std::unique_ptr<Component>> components_;  // null once dropped by an update
+  std::vector<size_t> free_component_idxs_;  // of the null slots, reused by later updates
+  std::unordered_map<std::string, StopLocation> stop_locations_;
+  PartsMemory peak_memory_;
 };
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <functional>
+#include <future>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <string_view>
 #include <unordered_map>
 #include <unordered_set>
@@ -41,3 +45,49 @@ const V* GetValuePointer(const std::unordered_map<K, V>& map, const K& key) {
 }
 
 std::string_view Strip(std::string_view line);
+
+// Object built by the factory on the first Get(); concurrent callers wait for the same build
+template <typename T>
+class Lazy {
+public:
+  explicit Lazy(std::function<std::unique_ptr<T>()> factory) : factory_(std::move(factory)) {}
+
+  const T& Get() const {
+    std::lock_guard guard(mutex_);
+    if (!value_) {
+      value_ = factory_();
+    }
+    return *value_;
+  }
+
+  // Starts the build on a background thread; Get() then waits for it instead of building again
+  void StartBuild() const {
+    if (!background_build_.valid()) {
+      background_build_ = std::async(std::launch::async, [this] { Get(); });
+    }
+  }
+
+  // For in-place updates: the object if it has been built, waiting for a background build
+  T* GetIfBuilt() {
+    WaitBackgroundBuild();
+    return value_.get();
+  }
+
+  // Drops the object, so that the next Get() builds it from scratch
+  void Reset() {
+    WaitBackgroundBuild();
+    value_.reset();
+  }
+
+private:
+  void WaitBackgroundBuild() {
+    if (background_build_.valid()) {
+      background_build_.get();
+    }
+  }
+
+  std::function<std::unique_ptr<T>()> factory_;
+  mutable std::mutex mutex_;
+  mutable std::unique_ptr<T> value_;
+  mutable std::future<void> background_build_;  // declared last: joined before value_ is destroyed
+};